@@ -3,25 +3,40 @@
 #include "../utils/dirhelper.hpp"
 
 #include <algorithm>
-#include <execution>
 #include <vector>
+#include <type_traits>
+#include <mutex>
+#include <condition_variable>
 
 namespace img = libimage;
 namespace dir = dirhelper;
 
 
+// bits of each color channel used to compare images
+// the histogram has 2^(3 * bits) buckets and must fit in the width of a category
+constexpr u32 HIST_CHANNEL_BITS = 2;
+
+constexpr size_t HIST_BUCKETS = img::color_hist_buckets<HIST_CHANNEL_BITS>();
+
+using Histogram = img::color_hist_t<HIST_CHANNEL_BITS>;
+
+using IntegralHist = img::color_integral_hist_t<HIST_CHANNEL_BITS>;
+
+
 typedef struct cat_info_t
 {
 	fs::path directory;
 	img::pixel_t background_color;
 	img::pixel_range_t buffer_range;
-	img::hist_t hist;
+	Histogram hist;
 
 } CategoryInfo;
 
 
 using category_list_t = std::array<CategoryInfo, 3>;
 
+static_assert(std::tuple_size<category_list_t>::value <= 32, "AppState::linked_categories has a bit for each category");
+
 using PixelRange = img::pixel_range_t;
 
 PixelRange empty_range() { img::pixel_range_t r = {}; return r; }
@@ -36,25 +51,57 @@ enum class AppMode : u32
 };
 
 
+enum class SortMode : u32
+{
+	Move,     // each image is moved when it is sorted
+	Manifest, // sorted images are recorded and moved together later
+	Link,     // images stay and are linked into any number of categories
+};
+
+
+// an image sorted in SortMode::Manifest
+typedef struct sort_decision_t
+{
+	u32 file_index;
+	u32 category;
+
+} SortDecision;
+
+
+// lives at the start of permanent storage and is never constructed
+// everything it points to is in AppMemory so it can be copied with memcpy
 typedef struct app_state_t
 {
-	AppMode mode = AppMode::None;
-	bool app_started = false;
-	bool dir_started = false;
-	bool dir_complete = false;
+	AppMode mode;
+	bool app_started;
+	bool dir_started;
+	bool dir_complete;
 
-	dir::file_list_t image_files;
 	u32 current_index;
+	u32 linked_categories; // bit for each category the current image is linked into
 
-	img::image_t current_image_resized;
+	img::view_t current_image_resized;
 
-	PixelRange image_roi = empty_range();
+	PixelRange image_roi;
 
-	img::hist_t current_hist = img::empty_hist();
+	Histogram current_hist;
+	IntegralHist current_integral;
+	img::arena_t current_arena; // memory of current_integral
+
+	SortDecision* decisions; // images sorted and not moved yet
+	u32 n_decisions;
+	u32 max_decisions;
+
+	dir::file_listing_t files; // published by image_stream
+
+	img::arena_t permanent; // permanent storage after the state
 
 } AppState;
 
 
+static_assert(std::is_trivially_copyable<AppState>::value, "AppState must be copyable with memcpy");
+
+
 typedef struct point_2d_u32_t
 {
 	u32 x;
@@ -66,18 +113,50 @@ typedef struct point_2d_u32_t
 
 //======= CONFIG =======================
 
-constexpr u32 MAX_IMAGES = 1000;
+// number of images loaded ahead of the current image
+constexpr u32 PREFETCH_DEPTH = 4;
+
+// number of images loaded at the same time
+constexpr u32 PREFETCH_LOADS = 2;
+
+// limit the libimage worker threads, 0 = one per core
+constexpr u32 MAX_WORKER_THREADS = 0;
+
+// integral histogram cells across the width of an image
+// the roi histogram is rounded to these cells
+constexpr u32 ROI_HIST_CELLS = 128;
+
+// transient memory for each image loaded, reset when another image is loaded into it
+constexpr size_t IMAGE_ARENA_BYTES = Megabytes(8);
+
+// permanent memory for the names of the images found, 1/8 of it is for their offsets
+constexpr size_t FILE_LIST_BYTES = Megabytes(192);
 
 constexpr auto IMAGE_EXTENSION = ".png";
 constexpr auto IMAGE_DIR = "C:/D_Data/test_images/src_pass";
 
+// the image listing is reused from here until IMAGE_DIR changes
+constexpr auto IMAGE_LIST_CACHE = "C:/D_Data/test_images/src_pass.scancache";
+
+// images saved into IMAGE_DIR while sorting are shown after the others, Linux only
+constexpr auto WATCH_IMAGE_DIR = true;
+
+// every image moved is recorded here so that it can be moved back
+constexpr auto IMAGE_MOVE_JOURNAL = "C:/D_Data/test_images/src_pass.journal";
+
+// SortMode::Manifest keeps sorting at the same speed on slow storage
+constexpr auto SORT_MODE = SortMode::Move;
+
+// sorted images are moved when this many have been recorded, or at the end
+constexpr u32 MAX_SORT_DECISIONS = 1 << 20;
+
 
 
 
 category_list_t categories = { {
-	{ "C:/D_Data/test_images/sorted_red",   img::to_pixel(255, 0, 0), empty_range(), img::empty_hist() },
-	{ "C:/D_Data/test_images/sorted_green", img::to_pixel(0, 255, 0), empty_range(), img::empty_hist() },
-	{ "C:/D_Data/test_images/sorted_blue",  img::to_pixel(0, 0, 255), empty_range(), img::empty_hist() }
+	{ "C:/D_Data/test_images/sorted_red",   img::to_pixel(255, 0, 0), empty_range(), img::empty_hist<HIST_BUCKETS>() },
+	{ "C:/D_Data/test_images/sorted_green", img::to_pixel(0, 255, 0), empty_range(), img::empty_hist<HIST_BUCKETS>() },
+	{ "C:/D_Data/test_images/sorted_blue",  img::to_pixel(0, 0, 255), empty_range(), img::empty_hist<HIST_BUCKETS>() }
 } };
 
 
@@ -96,23 +175,28 @@ constexpr PixelRange ICON_ROI_SELECT_RANGE = { SIDEBAR_XSTART, SIDEBAR_XEND, SID
 constexpr PixelRange IMAGE_RANGE    = { IMAGE_XSTART,    IMAGE_XEND,    0, app::BUFFER_HEIGHT };
 constexpr PixelRange CATEGORY_RANGE = { CATEGORY_XSTART, CATEGORY_XEND, 0, app::BUFFER_HEIGHT };
 
+// the roi histogram is shown over the lower left corner of the image while it is selected
+constexpr u32 ROI_HIST_MARGIN = 8;
+constexpr u32 ROI_HIST_WIDTH  = static_cast<u32>(HIST_BUCKETS) * 4 + 1;
+constexpr u32 ROI_HIST_HEIGHT = 100;
+
+constexpr PixelRange ROI_HIST_RANGE = {
+	IMAGE_XSTART + ROI_HIST_MARGIN, IMAGE_XSTART + ROI_HIST_MARGIN + ROI_HIST_WIDTH,
+	app::BUFFER_HEIGHT - ROI_HIST_MARGIN - ROI_HIST_HEIGHT, app::BUFFER_HEIGHT - ROI_HIST_MARGIN };
+
 using PixelBuffer = app::pixel_buffer_t;
 using AppMemory = app::AppMemory;
 
 
-static u32 to_buffer_color(PixelBuffer const& buffer, img::pixel_t const& p)
+static u32 to_buffer_color(img::pixel_t const& p)
 {
-	return buffer.to_color32(p.red, p.green, p.blue);
+	return img::to_format<app::BUFFER_FORMAT>(p).value;
 }
 
 
-static img::pixel_t to_buffer_pixel(PixelBuffer const& buffer, img::pixel_t const& p)
+static img::pixel_t to_buffer_pixel(img::pixel_t const& p)
 {
-	img::pixel_t bp = {};
-
-	bp.value = to_buffer_color(buffer, p);
-
-	return bp;
+	return img::to_format<app::BUFFER_FORMAT>(p);
 }
 
 
@@ -151,7 +235,7 @@ static b32 in_range(P2u32 const& pos, PixelRange const& range)
 }
 
 
-static void append_histogram(img::hist_t const& src, img::hist_t& dst)
+static void append_histogram(Histogram const& src, Histogram& dst)
 {
 	for (size_t i = 0; i < src.size(); ++i)
 	{
@@ -162,7 +246,7 @@ static void append_histogram(img::hist_t const& src, img::hist_t& dst)
 
 static void fill_buffer(PixelBuffer const& buffer, img::pixel_t const& color)
 {
-	auto c = to_buffer_color(buffer, color);
+	auto c = to_buffer_color(color);
 
 	auto size = static_cast<size_t>(buffer.width) * buffer.width;
 	u32* pixel = (u32*)buffer.memory;
@@ -207,9 +291,9 @@ static void fill_rect(img::pixel_t const& color, PixelBuffer const& buffer, Pixe
 	auto buffer_view = make_buffer_view(buffer);
 	auto dst_view = img::sub_view(buffer_view, dst_range);
 
-	auto bp = to_buffer_pixel(buffer, color);
+	auto bp = to_buffer_pixel(color);
 
-	std::fill(dst_view.begin(), dst_view.end(), bp);
+	img::for_each_row(dst_view, [&](img::pixel_t* row, u32 width) { std::fill(row, row + width, bp); });
 }
 
 
@@ -261,7 +345,7 @@ static void draw_rect(img::pixel_t const& line_color, PixelBuffer const& buffer,
 }
 
 
-static void draw_image(img::image_t const& image, PixelBuffer const& buffer, u32 x_begin, u32 y_begin)
+static void draw_image(img::view_t const& image, PixelBuffer const& buffer, u32 x_begin, u32 y_begin)
 {
 	u32 x_end = x_begin + image.width;
 	if (x_end > buffer.width)
@@ -279,20 +363,22 @@ static void draw_image(img::image_t const& image, PixelBuffer const& buffer, u32
 	auto buffer_view = make_buffer_view(buffer);
 	auto dst_view = img::sub_view(buffer_view, dst_range);
 
-	std::copy(image.begin(), image.end(), dst_view.begin());
+	// image rows are clipped to the buffer
+	u32 y = 0;
+
+	img::for_each_row(dst_view, [&](img::pixel_t* row, u32 width)
+	{
+		auto src = image.row_begin(y++);
+		std::copy(src, src + width, row);
+	});
 }
 
 
 
-static void convert_image(img::image_t const& src, img::image_t& dst, PixelBuffer const& buffer)
+// resizes and converts to buffer pixels in one pass over dst
+static void convert_image(img::image_t const& src, img::view_t const& dst)
 {
-	img::image_t resized;
-	resized.width = dst.width;
-	resized.height = dst.height;
-
-	img::resize_image(src, resized);
-
-	std::transform(resized.begin(), resized.end(), dst.begin(), [&](img::pixel_t const& p) { return to_buffer_pixel(buffer, p); });
+	img::resize_to_format<app::BUFFER_FORMAT>(src, dst);
 }
 
 
@@ -317,60 +403,406 @@ static void draw_relative_qty(u32 qty, u32 total, PixelBuffer const& buffer, Pix
 
 	auto bar = img::sub_view(region, bar_range);
 
-	std::fill(bar.begin(), bar.end(), black);
+	img::for_each_row(bar, [&](img::pixel_t* row, u32 width) { std::fill(row, row + width, black); });
 }
 
 
-static void load_next_image(AppState& state, PixelBuffer const& buffer)
+//======= FILE LIST ====================
+
+// images are listed on another thread and can be loaded before the listing is done
+dir::file_stream_t image_stream;
+
+
+static void image_stream_listed();
+
+
+// the names are in permanent memory, the listing is in the state
+static void image_stream_start(AppState& state)
 {
-	if (!state.dir_started)
+	auto& stream = image_stream;
+	auto& files = state.files;
+
+	auto n_offsets = FILE_LIST_BYTES / 8 / sizeof(u32);
+	auto n_names = (FILE_LIST_BYTES - n_offsets * sizeof(u32)) / sizeof(dir::char_t);
+
+	files.offsets = img::push_array<u32>(state.permanent, n_offsets);
+	files.names = img::push_array<dir::char_t>(state.permanent, n_names);
+	files.removed = img::push_array<u64>(state.permanent, dir::removed_words(n_offsets));
+	files.max_files = n_offsets;
+	files.names_capacity = n_names;
+
+	assert(files.offsets);
+	assert(files.names);
+	assert(files.removed);
+
+	stream.listing = &files;
+	stream.on_listed = image_stream_listed;
+	stream.cache_path = IMAGE_LIST_CACHE;
+	stream.watch = WATCH_IMAGE_DIR;
+
+	dir::start_files_of_type(stream, IMAGE_DIR, IMAGE_EXTENSION);
+}
+
+
+// sorted images are moved off the ui thread
+dir::move_queue_t image_mover;
+
+
+//======= PREFETCH =====================
+
+enum class SlotState : u32
+{
+	Empty,
+	Loading,
+	Ready,
+};
+
+
+// an image loaded ahead of the cursor
+typedef struct prefetch_slot_t
+{
+	SlotState slot_state = SlotState::Empty;
+	u32 file_index = 0;
+	bool has_image = false; // the file was deleted before it was loaded
+
+	img::view_t image;     // resized and converted to buffer pixels, in transient storage
+	IntegralHist integral; // of the original image, any roi is scored without loading it again
+	img::arena_t arena;    // memory of integral
+
+} PrefetchSlot;
+
+
+typedef struct prefetch_queue_t
+{
+	std::mutex mutex;
+	std::condition_variable cv;
+
+	std::array<PrefetchSlot, PREFETCH_DEPTH> slots;
+
+	dir::file_stream_t* files = nullptr;
+
+	u32 cursor = 0;    // next index to be taken by the ui
+	u32 next_load = 0; // next index to be claimed by a worker
+	u32 n_loading = 0;
+
+	bool running = false;
+
+} PrefetchQueue;
+
+
+PrefetchQueue prefetch_queue;
+
+
+static b32 can_claim(PrefetchQueue const& queue)
+{
+	auto index = queue.next_load;
+
+	return index < dir::files_listed(*queue.files) &&
+		index < queue.cursor + PREFETCH_DEPTH &&
+		queue.slots[index % PREFETCH_DEPTH].slot_state != SlotState::Loading;
+}
+
+
+// images claimed with the queue locked, queued after it is unlocked
+// run_async can load on the calling thread, which takes the queue lock again
+typedef struct prefetch_claims_t
+{
+	std::array<u32, PREFETCH_LOADS> indices;
+	u32 count = 0;
+
+} PrefetchClaims;
+
+
+static void prefetch_load(PrefetchQueue& queue, u32 index);
+
+
+// call with the queue locked
+static void prefetch_pump(PrefetchQueue& queue, PrefetchClaims& claims)
+{
+	while (queue.running && queue.n_loading < PREFETCH_LOADS && can_claim(queue))
 	{
-		state.dir_started = true;
-		state.current_index = 0;
+		auto index = queue.next_load++;
+		auto& slot = queue.slots[index % PREFETCH_DEPTH];
+		slot.slot_state = SlotState::Loading;
+		slot.file_index = index;
+
+		++queue.n_loading;
+		claims.indices[claims.count++] = index;
 	}
-	else
+}
+
+
+// loads the claimed images on the libimage workers
+// call with the queue unlocked
+static void prefetch_run(PrefetchQueue& queue, PrefetchClaims const& claims)
+{
+	for (u32 i = 0; i < claims.count; ++i)
 	{
-		++state.current_index;
+		auto index = claims.indices[i];
+		img::run_async([&queue, index]() { prefetch_load(queue, index); });
 	}
+}
+
 
-	if (state.current_index >= state.image_files.size())
+static void prefetch_load(PrefetchQueue& queue, u32 index)
+{
+	auto& slot = queue.slots[index % PREFETCH_DEPTH];
+
+	// slot is not touched by other threads while Loading
+	slot.has_image = !dir::file_removed(*queue.files, index);
+	if (slot.has_image)
 	{
-		state.dir_complete = true;
-		return;
+		img::image_t image;
+		img::read_image_from_file(dir::get_file(*queue.files, index), image);
+
+		// larger cells for images too tall to fit
+		auto cell_size = std::max(image.width / ROI_HIST_CELLS, 1u);
+		while (img::integral_hist_bytes<HIST_BUCKETS>(image.width, image.height, cell_size) > slot.arena.capacity)
+		{
+			cell_size *= 2;
+		}
+
+		img::reset_arena(slot.arena);
+		img::make_color_integral_hist<HIST_CHANNEL_BITS>(slot.integral, img::make_view(image), cell_size, slot.arena);
+
+		convert_image(image, slot.image);
 	}
 
-	auto& current_entry = state.image_files[state.current_index];
+	PrefetchClaims claims;
 
-	img::image_t image;
-	img::read_image_from_file(current_entry, image);
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		slot.slot_state = SlotState::Ready;
+		--queue.n_loading;
+
+		prefetch_pump(queue, claims);
+	}
+
+	queue.cv.notify_all();
+
+	prefetch_run(queue, claims);
+}
+
+
+static void prefetch_start(img::arena_t& transient)
+{
+	auto& queue = prefetch_queue;
+
+	u32 width = IMAGE_RANGE.x_end - IMAGE_RANGE.x_begin;
+	u32 height = IMAGE_RANGE.y_end - IMAGE_RANGE.y_begin;
+
+	for (auto& slot : queue.slots)
+	{
+		slot.image = img::push_view(transient, width, height);
+		slot.arena = img::push_arena(transient, IMAGE_ARENA_BYTES);
+		slot.slot_state = SlotState::Empty;
+
+		assert(slot.image.image_data);
+		assert(slot.arena.capacity);
+	}
 
-	state.current_hist = img::calc_hist(img::sub_view(image, state.image_roi));
+	PrefetchClaims claims;
 
-	convert_image(image, state.current_image_resized, buffer);
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		queue.files = &image_stream;
+		queue.cursor = 0;
+		queue.next_load = 0;
+		queue.n_loading = 0;
+		queue.running = true;
+
+		prefetch_pump(queue, claims);
+	}
+
+	prefetch_run(queue, claims);
+}
+
+
+// waits for loads in progress
+static void prefetch_stop()
+{
+	auto& queue = prefetch_queue;
+
+	std::unique_lock<std::mutex> lock(queue.mutex);
+
+	queue.running = false;
+	queue.cv.wait(lock, [&]() { return queue.n_loading == 0; });
+}
+
+
+// more images can be claimed
+static void image_stream_listed()
+{
+	auto& queue = prefetch_queue;
+
+	PrefetchClaims claims;
+
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		prefetch_pump(queue, claims);
+	}
+
+	prefetch_run(queue, claims);
+}
+
+
+// blocks until the image at index has been loaded
+// swaps the loaded image into image_dst so that no pixels are copied
+// returns false if the file was deleted instead
+static b32 prefetch_take(u32 index, img::view_t& image_dst, IntegralHist& integral_dst, img::arena_t& arena_dst)
+{
+	auto& queue = prefetch_queue;
+	auto& slot = queue.slots[index % PREFETCH_DEPTH];
+	b32 has_image = false;
+
+	PrefetchClaims claims;
+
+	{
+		std::unique_lock<std::mutex> lock(queue.mutex);
+
+		assert(index == queue.cursor);
+
+		auto const slot_ready = [&]()
+		{
+			return slot.slot_state == SlotState::Ready && slot.file_index == index;
+		};
+
+		queue.cv.wait(lock, slot_ready);
+
+		has_image = slot.has_image;
+		if (has_image)
+		{
+			assert(slot.image.width == image_dst.width);
+			assert(slot.image.height == image_dst.height);
+
+			std::swap(slot.image, image_dst);
+			std::swap(slot.integral, integral_dst);
+			std::swap(slot.arena, arena_dst);
+		}
+
+		slot.slot_state = SlotState::Empty;
+		queue.cursor = index + 1;
+
+		prefetch_pump(queue, claims);
+	}
+
+	queue.cv.notify_all();
+
+	prefetch_run(queue, claims);
+
+	return has_image;
+}
+
+
+// the roi is clamped to the image and can be selected in any direction
+static Histogram roi_hist(IntegralHist const& integral, PixelRange const& roi)
+{
+	PixelRange range = {};
+	range.x_begin = std::min(std::min(roi.x_begin, roi.x_end), integral.width - 1);
+	range.x_end = std::min(std::max(roi.x_begin, roi.x_end), integral.width - 1) + 1;
+	range.y_begin = std::min(std::min(roi.y_begin, roi.y_end), integral.height - 1);
+	range.y_end = std::min(std::max(roi.y_begin, roi.y_end), integral.height - 1) + 1;
+
+	return img::calc_hist(integral, range);
+}
+
+
+// deleted images are skipped
+static void load_current_image(AppState& state, PixelBuffer const& buffer)
+{
+	for (;; ++state.current_index)
+	{
+		// the first images are shown before the listing is done
+		if (state.current_index >= dir::wait_for_file(image_stream, state.current_index))
+		{
+			state.dir_complete = true;
+			return;
+		}
+
+		if (prefetch_take(state.current_index, state.current_image_resized, state.current_integral, state.current_arena))
+		{
+			break;
+		}
+	}
+
+	state.dir_complete = false;
+	state.linked_categories = 0;
+	state.current_hist = roi_hist(state.current_integral, state.image_roi);
 
 	draw_image(state.current_image_resized, buffer, IMAGE_RANGE.x_begin, IMAGE_RANGE.y_begin);
 }
 
 
+static void load_next_image(AppState& state, PixelBuffer const& buffer)
+{
+	if (!state.dir_started)
+	{
+		state.dir_started = true;
+		state.current_index = 0;
+	}
+	else
+	{
+		++state.current_index;
+	}
+
+	load_current_image(state, buffer);
+}
+
+
 static void initialize_memory(AppMemory& memory, AppState& state)
 {
+	auto permanent_begin = (u8*)memory.permanent_storage + sizeof(AppState);
+	state.permanent = img::make_arena(permanent_begin, memory.permanent_storage_size - sizeof(AppState));
+
+	state.mode = AppMode::None;
+	state.app_started = false;
 	state.dir_started = false;
 	state.dir_complete = false;
+	state.current_index = 0;
+	state.linked_categories = 0;
+	state.current_hist = img::empty_hist<HIST_BUCKETS>();
+
+	img::set_max_workers(MAX_WORKER_THREADS);
 
-	state.image_files = dir::get_files_of_type(IMAGE_DIR, IMAGE_EXTENSION, MAX_IMAGES);
+	// directories are scanned and moved on the image workers
+	dir::set_parallel_for([](u32 begin, u32 end, dir::range_func_t const& func) { img::parallel_for(begin, end, func); });
+
+	// images moved by a session that did not end are moved back for testing
+	dir::undo_moves(IMAGE_MOVE_JOURNAL);
+
+	image_stream_start(state);
+
+	state.decisions = img::push_array<SortDecision>(state.permanent, MAX_SORT_DECISIONS);
+	state.n_decisions = 0;
+	state.max_decisions = MAX_SORT_DECISIONS;
+	assert(state.decisions);
+
+	image_mover.journal_path = IMAGE_MOVE_JOURNAL;
+	dir::start_moves(image_mover);
+
+	state.image_roi = { 55, 445, 55, 445 }; // TODO: set by user
 
 	u32 width = IMAGE_RANGE.x_end - IMAGE_RANGE.x_begin;
 	u32 height = IMAGE_RANGE.y_end - IMAGE_RANGE.y_begin;
-	img::make_image(state.current_image_resized, width, height);
 
-	state.image_roi = { 55, 445, 55, 445 }; // TODO: set by user
+	auto transient = img::make_arena(memory.transient_storage, memory.transient_storage_size);
+	state.current_image_resized = img::push_view(transient, width, height);
+	state.current_arena = img::push_arena(transient, IMAGE_ARENA_BYTES);
+
+	assert(state.current_image_resized.image_data);
+
+	// start loading images in the background
+	prefetch_start(transient);
 }
 
 
 static void draw_stats(category_list_t const& categories, PixelBuffer const& buffer)
 {
 	auto buffer_view = make_buffer_view(buffer);
-	img::pixel_t color = to_buffer_pixel(buffer, img::to_pixel(50, 50, 50));
+	img::pixel_t color = to_buffer_pixel(img::to_pixel(50, 50, 50));
 
 	for (auto const& cat : categories)
 	{
@@ -382,6 +814,17 @@ static void draw_stats(category_list_t const& categories, PixelBuffer const& buf
 }
 
 
+static void draw_roi_hist(Histogram const& hist, PixelBuffer const& buffer)
+{
+	auto buffer_view = make_buffer_view(buffer);
+	auto view = img::sub_view(buffer_view, ROI_HIST_RANGE);
+	img::pixel_t color = to_buffer_pixel(img::to_pixel(50, 250, 50));
+
+	fill_rect(img::to_pixel(255, 255, 255), buffer, ROI_HIST_RANGE);
+	img::draw_histogram(hist, view, color);
+}
+
+
 static void draw_roi_select_icon(AppState const& state, PixelBuffer const& buffer)
 {
 	auto& range = ICON_ROI_SELECT_RANGE;
@@ -474,6 +917,52 @@ static b32 skip_image_executed(Input const& input, AppState& state, PixelBuffer
 }
 
 
+// every image recorded in SortMode::Manifest is moved in one batch on the mover thread
+static void apply_sort_decisions(AppState& state)
+{
+	if (!state.n_decisions)
+	{
+		return;
+	}
+
+	std::vector<dir::FileMove> moves(state.n_decisions);
+
+	for (u32 i = 0; i < state.n_decisions; ++i)
+	{
+		auto& decision = state.decisions[i];
+		moves[i].file = dir::get_file(image_stream, decision.file_index);
+		moves[i].dst_dir = categories[decision.category].directory;
+	}
+
+	dir::move_files_async(image_mover, moves);
+
+	state.n_decisions = 0;
+}
+
+
+static void sort_image(AppState& state, u32 category)
+{
+	if constexpr (SORT_MODE == SortMode::Move)
+	{
+		dir::move_file_async(image_mover, dir::get_file(image_stream, state.current_index), categories[category].directory);
+		return;
+	}
+
+	if constexpr (SORT_MODE == SortMode::Link)
+	{
+		dir::link_file_async(image_mover, dir::get_file(image_stream, state.current_index), categories[category].directory);
+		return;
+	}
+
+	if (state.n_decisions == state.max_decisions)
+	{
+		apply_sort_decisions(state);
+	}
+
+	state.decisions[state.n_decisions++] = { state.current_index, category };
+}
+
+
 static b32 move_image_executed(Input const& input, AppState& state, PixelBuffer const& buffer)
 {
 	auto& mouse = input.mouse;
@@ -484,15 +973,33 @@ static b32 move_image_executed(Input const& input, AppState& state, PixelBuffer
 	if (!condition_to_execute)
 		return false;
 
-	for (auto& cat : categories)
+	for (u32 i = 0; i < categories.size(); ++i)
 	{
+		auto& cat = categories[i];
+
 		if (in_range(buffer_pos, cat.buffer_range))
 		{
+			if constexpr (SORT_MODE == SortMode::Link)
+			{
+				// an image is linked into each category once
+				if (state.linked_categories & (1u << i))
+				{
+					break;
+				}
+
+				state.linked_categories |= 1u << i;
+			}
+
 			append_histogram(state.current_hist, cat.hist);
-			dir::move_file(state.image_files[state.current_index], cat.directory);
+			sort_image(state, i);
 
 			draw_stats(categories, buffer);
-			load_next_image(state, buffer);
+
+			// linked images can be sorted again into other categories until skipped
+			if constexpr (SORT_MODE != SortMode::Link)
+			{
+				load_next_image(state, buffer);
+			}
 
 			break;
 		}
@@ -502,6 +1009,20 @@ static b32 move_image_executed(Input const& input, AppState& state, PixelBuffer
 }
 
 
+// an image was added to the watched directory after the others were sorted
+static b32 new_image_executed(Input const& input, AppState& state, PixelBuffer const& buffer)
+{
+	auto condition_to_execute = state.dir_complete && state.current_index < dir::files_listed(image_stream);
+
+	if (!condition_to_execute)
+		return false;
+
+	load_current_image(state, buffer);
+
+	return true;
+}
+
+
 static b32 draw_blank_image_executed(Input const& input, AppState& state, PixelBuffer const& buffer)
 {
 	auto condition_to_execute = state.dir_complete;
@@ -575,11 +1096,15 @@ static b32 select_range_in_progress_executed(Input const& input, AppState& state
 	state.image_roi.x_end = buffer_pos.x;
 	state.image_roi.y_end = buffer_pos.y;
 
+	state.current_hist = roi_hist(state.current_integral, state.image_roi);
+
 	draw_image(state.current_image_resized, buffer, IMAGE_RANGE.x_begin, IMAGE_RANGE.y_begin);
 
 	auto line_color = img::to_pixel(50, 250, 50);
 	draw_rect(line_color, buffer, state.image_roi);
 
+	draw_roi_hist(state.current_hist, buffer);
+
 	return true;
 }
 
@@ -599,6 +1124,7 @@ static b32 select_range_end_executed(Input const& input, AppState& state, PixelB
 
 	state.mode = AppMode::SelectRegionReady;
 
+	state.current_hist = roi_hist(state.current_integral, state.image_roi);
 
 	return true;
 }
@@ -649,6 +1175,11 @@ namespace app
 				return;
 			}
 			
+			if (new_image_executed(input, state, buffer))
+			{
+				return;
+			}
+
 			if (draw_blank_image_executed(input, state, buffer))
 			{
 				return;
@@ -689,18 +1220,23 @@ namespace app
 	}
 
 
-	void end_program()
-	{	
-		// move images back to their original directory for testing
-		auto root = fs::path(IMAGE_DIR);
+	void end_program(AppMemory& memory)
+	{
+		dir::stop_stream(image_stream);
 
-		for (auto const& cat : categories)
+		if (memory.is_app_initialized)
 		{
-			auto& dir = cat.directory;
-			for (auto& entry : fs::directory_iterator(dir))
-			{
-				dir::move_file(entry, root);
-			}
+			apply_sort_decisions(*(AppState*)memory.permanent_storage);
 		}
+
+		dir::stop_moves(image_mover);
+
+		prefetch_stop();
+
+		// move images back to their original directory for testing
+		dir::undo_moves(IMAGE_MOVE_JOURNAL);
+
+		img::stop_workers();
+		img::release_image_memory();
 	}
 }
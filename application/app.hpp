@@ -1,8 +1,7 @@
 #pragma once
 
 #include "../input/input.hpp"
-
-#include <functional>
+#include "../utils/libimage/libimage.hpp"
 
 namespace app
 {
@@ -18,7 +17,9 @@ namespace app
 	} AppMemory;
 
 
-	using to_color32_f = std::function<u32(u8 red, u8 green, u8 blue)>;
+	// order of the channels of each pixel in PixelBuffer memory
+	// 32 bit value red << 16 | green << 8 | blue
+	constexpr auto BUFFER_FORMAT = libimage::PixelFormat::BGRA;
 
 
 	typedef struct pixel_buffer_t
@@ -28,8 +29,6 @@ namespace app
 		u32 height;
 		u32 bytes_per_pixel;
 
-		to_color32_f to_color32;
-
 	} PixelBuffer;
 
 
@@ -39,6 +38,6 @@ namespace app
 
 	void update_and_render(AppMemory& memory, Input const& input, PixelBuffer const& buffer);
 
-	void end_program();
+	void end_program(AppMemory& memory);
 	
 }
\ No newline at end of file
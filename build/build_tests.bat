@@ -0,0 +1,45 @@
+@echo off
+
+rem cd /d D:\repos\ImageSort\build
+
+set logfile=tests.log
+
+set defines=/D "_CONSOLE" /D "_UNICODE" /D "UNICODE" /D "NDEBUG"
+
+set opts=/Oi /EHa- /GR- /Gm- /nologo /FC /Zi /MT /EHsc /permissive- /Zc:inline /fp:precise /diagnostics:column
+
+set warnings=-W4 -wd4201 -wd4100 -wd4505 -wd4189
+set standard=/std:c++17
+
+set options=%defines% %opts% %warnings% %standard%
+
+set root=D:\repos\ImageSort\
+
+set utils=%root%\utils\
+
+set utils_cpp=%utils%\dirhelper.cpp %utils%\libimage\libimage.cpp
+
+set tests=%root%\tests\
+
+echo %time% > %logfile%
+
+cl %tests%\prefetch_test.cpp %utils_cpp% %options% /Fe:prefetch_test.exe >> %logfile%
+prefetch_test.exe >> %logfile%
+
+rem includes libimage.cpp to hook its allocations
+cl %tests%\alloc_test.cpp %options% /Fe:alloc_test.exe >> %logfile%
+
+cl %tests%\hist_bench.cpp %utils%\libimage\libimage.cpp %options% /Fe:hist_bench.exe >> %logfile%
+hist_bench.exe >> %logfile%
+
+cl %tests%\hist_bench.cpp %utils%\libimage\libimage.cpp %options% /D "LIBIMAGE_NO_SIMD" /Fe:hist_bench_scalar.exe >> %logfile%
+hist_bench_scalar.exe >> %logfile%
+alloc_test.exe >> %logfile%
+
+cl %tests%\hist_bench.cpp %utils%\libimage\libimage.cpp %options% /Fe:hist_bench.exe >> %logfile%
+hist_bench.exe >> %logfile%
+
+cl %tests%\hist_bench.cpp %utils%\libimage\libimage.cpp %options% /D "LIBIMAGE_NO_SIMD" /Fe:hist_bench_scalar.exe >> %logfile%
+hist_bench_scalar.exe >> %logfile%
+
+echo %time% >> %logfile%
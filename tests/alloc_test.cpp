@@ -0,0 +1,220 @@
+// counts heap allocations while paging through images after a warm-up
+// libimage.cpp is included so that stb and the system allocations of image memory can be hooked
+
+#include "../utils/libimage/libimage.hpp"
+#include "../utils/typedefs.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <condition_variable>
+#include <memory>
+
+namespace img = libimage;
+
+
+constexpr u32 N_FIXTURE_IMAGES = 20;
+constexpr u32 N_WARM_UP_IMAGES = 2 * N_FIXTURE_IMAGES;
+constexpr u32 N_PAGED_IMAGES = 10000;
+
+constexpr u32 FIXTURE_WIDTH = 640;
+constexpr u32 FIXTURE_HEIGHT = 480;
+
+// the size of the app's image area
+constexpr u32 VIEW_WIDTH = 960;
+constexpr u32 VIEW_HEIGHT = 720;
+
+constexpr u32 HIST_CHANNEL_BITS = 2;
+constexpr u32 ROI_HIST_CELLS = 128;
+
+
+static std::atomic<bool> counting = false;
+
+static std::atomic<u64> n_new = 0;
+static std::atomic<u64> n_malloc = 0;
+static std::atomic<u64> n_stbi = 0;
+
+
+static void* counted_malloc(size_t n_bytes)
+{
+	if (counting)
+	{
+		++n_malloc;
+	}
+
+	return std::malloc(n_bytes);
+}
+
+
+static void* counted_stbi_malloc(size_t n_bytes)
+{
+	if (counting)
+	{
+		++n_stbi;
+	}
+
+	return libimage::alloc_image_memory(n_bytes);
+}
+
+
+static void* counted_stbi_realloc(void* data, size_t n_bytes)
+{
+	if (counting)
+	{
+		++n_stbi;
+	}
+
+	return libimage::realloc_image_memory(data, n_bytes);
+}
+
+
+void* operator new(size_t n_bytes)
+{
+	if (counting)
+	{
+		++n_new;
+	}
+
+	if (auto data = std::malloc(n_bytes ? n_bytes : 1))
+	{
+		return data;
+	}
+
+	throw std::bad_alloc();
+}
+
+
+void* operator new[](size_t n_bytes)
+{
+	return operator new(n_bytes);
+}
+
+
+void operator delete(void* data) noexcept { std::free(data); }
+
+void operator delete[](void* data) noexcept { std::free(data); }
+
+void operator delete(void* data, size_t) noexcept { std::free(data); }
+
+void operator delete[](void* data, size_t) noexcept { std::free(data); }
+
+
+#define STBI_MALLOC(sz) counted_stbi_malloc(sz)
+#define STBI_REALLOC(p, newsz) counted_stbi_realloc(p, newsz)
+#define STBI_FREE(p) libimage::free_image_memory(p)
+
+// image memory takes blocks from the system with malloc when it has none of the size kept
+#define malloc(n_bytes) counted_malloc(n_bytes)
+
+#include "../utils/libimage/libimage.cpp"
+
+#undef malloc
+
+
+static img::pixel_t fixture_color(u32 i)
+{
+	return img::to_pixel(static_cast<u8>(10 * i), static_cast<u8>(255 - 10 * i), static_cast<u8>(i * i));
+}
+
+
+static std::vector<std::string> make_fixture(fs::path const& dir)
+{
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+
+	std::vector<std::string> files;
+
+	img::image_t image;
+	img::make_image(image, FIXTURE_WIDTH, FIXTURE_HEIGHT);
+	auto view = img::make_view(image);
+
+	for (u32 i = 0; i < N_FIXTURE_IMAGES; ++i)
+	{
+		// a gradient so that the png is not trivially small
+		for (u32 y = 0; y < FIXTURE_HEIGHT; ++y)
+		{
+			auto row = view.row_begin(y);
+			for (u32 x = 0; x < FIXTURE_WIDTH; ++x)
+			{
+				auto color = fixture_color(i);
+				color.red = static_cast<u8>(color.red + x);
+				color.blue = static_cast<u8>(color.blue + y);
+				row[x] = color;
+			}
+		}
+
+		auto file = dir / (std::to_string(i) + ".png");
+		img::write_image(image, file);
+		files.push_back(file.string());
+	}
+
+	return files;
+}
+
+
+int main()
+{
+	auto fixture_dir = fs::temp_directory_path() / "imagesort_alloc_test";
+	auto files = make_fixture(fixture_dir);
+
+	// everything the loop writes is made before it starts, like the app's transient storage
+	std::vector<u8> memory(Megabytes(64));
+	auto arena = img::make_arena(memory.data(), memory.size());
+	auto view = img::push_view(arena, VIEW_WIDTH, VIEW_HEIGHT);
+	auto hist_arena = img::push_arena(arena, Megabytes(8));
+
+	img::color_integral_hist_t<HIST_CHANNEL_BITS> integral = {};
+
+	u64 checksum = 0;
+
+	for (u32 i = 0; i < N_PAGED_IMAGES; ++i)
+	{
+		// the image memory and the worker threads are set up by the first images
+		counting = i >= N_WARM_UP_IMAGES;
+
+		img::image_t image;
+		img::read_image_from_file(files[i % N_FIXTURE_IMAGES].c_str(), image);
+
+		img::resize_to_format<img::PixelFormat::BGRA>(image, view);
+
+		auto cell_size = std::max(image.width / ROI_HIST_CELLS, 1u);
+
+		img::reset_arena(hist_arena);
+		img::make_color_integral_hist<HIST_CHANNEL_BITS>(integral, img::make_view(image), cell_size, hist_arena);
+
+		auto roi = img::calc_hist(integral, { 0, integral.width / 2, 0, integral.height / 2 });
+		checksum += static_cast<u64>(roi[i % roi.size()] * 1000) + view.xy_at(i % VIEW_WIDTH, i % VIEW_HEIGHT)->value;
+	}
+
+	counting = false;
+
+	img::stop_workers();
+	img::release_image_memory();
+
+	fs::remove_all(fixture_dir);
+
+	auto n_counted = N_PAGED_IMAGES - N_WARM_UP_IMAGES;
+
+	printf("after %u warm-up images, over %u images:\n", N_WARM_UP_IMAGES, n_counted);
+	printf("  operator new:        %llu\n", (unsigned long long)n_new);
+	printf("  image memory malloc: %llu\n", (unsigned long long)n_malloc);
+	printf("  stb allocations:     %llu (served from image memory)\n", (unsigned long long)n_stbi);
+	printf("  checksum:            %llu\n", (unsigned long long)checksum);
+
+	if (n_new || n_malloc)
+	{
+		printf("FAILED: paging allocates on the heap\n");
+		return 1;
+	}
+
+	printf("passed\n");
+
+	return 0;
+}
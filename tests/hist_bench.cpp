@@ -0,0 +1,137 @@
+// times row traversal and calc_hist against the per-pixel iterator on a 24 MP image
+// calc_hist runs on the libimage workers, the iterator count on one thread
+// build once as is and once with LIBIMAGE_NO_SIMD to time the scalar histogram
+
+#include "../utils/libimage/libimage.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace img = libimage;
+
+using clock_type = std::chrono::steady_clock;
+
+
+constexpr u32 IMAGE_WIDTH = 6000;
+constexpr u32 IMAGE_HEIGHT = 4000;
+
+// the view is inset so that its rows are not contiguous
+constexpr u32 VIEW_INSET = 10;
+
+constexpr u32 N_RUNS = 5;
+
+constexpr size_t HIST_BUCKETS = img::N_HIST_BUCKETS;
+
+
+// the fastest of N_RUNS, in milliseconds
+template <class F>
+static double time_ms(F const& func)
+{
+	double best = 0.0;
+
+	for (u32 i = 0; i < N_RUNS; ++i)
+	{
+		auto begin = clock_type::now();
+		func();
+		auto ms = std::chrono::duration<double, std::milli>(clock_type::now() - begin).count();
+
+		best = i ? std::min(best, ms) : ms;
+	}
+
+	return best;
+}
+
+
+static void fill_random(img::image_t const& image)
+{
+	u32 state = 12345;
+
+	std::for_each(image.begin(), image.end(), [&](img::pixel_t& p)
+	{
+		state = state * 1664525 + 1013904223;
+		p.value = state;
+		p.alpha = 255;
+	});
+}
+
+
+// the calc_hist bucket, one pixel at a time through the view iterator
+static img::hist_t<HIST_BUCKETS> iterator_hist(img::view_t const& view)
+{
+	constexpr u32 shift = 24 - 4; // 16 buckets
+	static_assert(HIST_BUCKETS == 16, "shift is for 16 buckets");
+
+	auto hist = img::empty_hist<HIST_BUCKETS>();
+
+	std::for_each(view.begin(), view.end(), [&](img::pixel_t const& p)
+	{
+		u32 rgb = static_cast<u32>(p.red) << 16 | static_cast<u32>(p.green) << 8 | p.blue;
+		++hist[rgb >> shift];
+	});
+
+	// calc_hist scales large counts down the same way
+	auto total = view.width * view.height;
+	if (total >= 10000)
+	{
+		auto divisor = 10 * (total / 10000);
+		for (auto& count : hist)
+		{
+			count /= divisor;
+		}
+	}
+
+	return hist;
+}
+
+
+int main()
+{
+	img::image_t image;
+	img::make_image(image, IMAGE_WIDTH, IMAGE_HEIGHT);
+	fill_random(image);
+
+	img::pixel_range_t range = { VIEW_INSET, IMAGE_WIDTH - VIEW_INSET, VIEW_INSET, IMAGE_HEIGHT - VIEW_INSET };
+	auto view = img::sub_view(image, range);
+
+	printf("%ux%u view of a %ux%u image, fastest of %u runs\n", view.width, view.height, IMAGE_WIDTH, IMAGE_HEIGHT, N_RUNS);
+
+	auto color = img::to_pixel(10, 20, 30);
+
+	auto fill_iterator_ms = time_ms([&]() { std::fill(view.begin(), view.end(), color); });
+	auto fill_row_ms = time_ms([&]() { img::for_each_row(view, [&](img::pixel_t* row, u32 width) { std::fill(row, row + width, color); }); });
+
+	printf("fill   iterator: %8.2f ms  for_each_row: %8.2f ms\n", fill_iterator_ms, fill_row_ms);
+
+	fill_random(image);
+
+	img::hist_t<HIST_BUCKETS> expected = {};
+	img::hist_t<HIST_BUCKETS> actual = {};
+
+	auto hist_iterator_ms = time_ms([&]() { expected = iterator_hist(view); });
+	auto hist_ms = time_ms([&]() { actual = img::calc_hist<HIST_BUCKETS>(view); });
+
+#if defined(LIBIMAGE_NO_SIMD)
+	auto path = "scalar";
+#elif defined(__AVX2__)
+	auto path = "avx2";
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	auto path = "sse2";
+#else
+	auto path = "scalar";
+#endif
+
+	printf("hist   iterator: %8.2f ms  calc_hist:    %8.2f ms (%s)\n", hist_iterator_ms, hist_ms, path);
+
+	img::stop_workers();
+
+	if (actual != expected)
+	{
+		printf("FAILED: calc_hist does not match the per-pixel count\n");
+		return 1;
+	}
+
+	printf("calc_hist matches the per-pixel count\n");
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+// next image latency through the prefetch queue, without a window
+// app.cpp is included so that its static functions can be called
+
+#include "../application/app.cpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+using clock_type = std::chrono::steady_clock;
+
+
+constexpr u32 N_FIXTURE_IMAGES = 12;
+constexpr u32 FIXTURE_WIDTH = 640;
+constexpr u32 FIXTURE_HEIGHT = 480;
+
+
+static int n_failed = 0;
+
+
+static void check(bool condition, const char* message)
+{
+	if (!condition)
+	{
+		printf("FAILED: %s\n", message);
+		++n_failed;
+	}
+}
+
+
+static img::pixel_t fixture_color(u32 i)
+{
+	return img::to_pixel(static_cast<u8>(20 * i), static_cast<u8>(255 - 20 * i), 128);
+}
+
+
+// each image is one color, its index is in the file name
+static void make_fixture(fs::path const& dir)
+{
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+
+	img::image_t image;
+	img::make_image(image, FIXTURE_WIDTH, FIXTURE_HEIGHT);
+
+	for (u32 i = 0; i < N_FIXTURE_IMAGES; ++i)
+	{
+		auto color = fixture_color(i);
+		std::fill(image.begin(), image.end(), color);
+
+		img::write_image(image, dir / (std::to_string(i) + ".png"));
+	}
+}
+
+
+static u32 fixture_index(fs::path const& file)
+{
+	return static_cast<u32>(std::stoul(file.stem().string()));
+}
+
+
+static double elapsed_ms(clock_type::time_point begin)
+{
+	return std::chrono::duration<double, std::milli>(clock_type::now() - begin).count();
+}
+
+
+static bool has_color(img::view_t const& view, img::pixel_t const& color)
+{
+	auto expected = to_buffer_pixel(color).value & 0x00FFFFFF;
+	auto center = *view.xy_at(view.width / 2, view.height / 2);
+
+	return (center.value & 0x00FFFFFF) == expected;
+}
+
+
+static void wait_until_ready(u32 index)
+{
+	auto& queue = prefetch_queue;
+	auto& slot = queue.slots[index % PREFETCH_DEPTH];
+
+	std::unique_lock<std::mutex> lock(queue.mutex);
+
+	queue.cv.wait(lock, [&]() { return slot.slot_state == SlotState::Ready && slot.file_index == index; });
+}
+
+
+int main()
+{
+	auto fixture_dir = fs::temp_directory_path() / "imagesort_prefetch_test";
+	make_fixture(fixture_dir);
+
+	// the listing is smaller than the app's
+	std::vector<u8> permanent_memory(Megabytes(1));
+	std::vector<u8> transient_memory((PREFETCH_DEPTH + 1) * (IMAGE_ARENA_BYTES + Megabytes(4)));
+
+	auto permanent = img::make_arena(permanent_memory.data(), permanent_memory.size());
+	auto transient = img::make_arena(transient_memory.data(), transient_memory.size());
+
+	dir::file_listing_t files = {};
+	files.max_files = 64;
+	files.names_capacity = 4096;
+	files.offsets = img::push_array<u32>(permanent, files.max_files);
+	files.names = img::push_array<dir::char_t>(permanent, files.names_capacity);
+	files.removed = img::push_array<u64>(permanent, dir::removed_words(files.max_files));
+
+	image_stream.listing = &files;
+	image_stream.on_listed = image_stream_listed;
+	dir::start_files_of_type(image_stream, fixture_dir, IMAGE_EXTENSION);
+
+	u32 width = IMAGE_RANGE.x_end - IMAGE_RANGE.x_begin;
+	u32 height = IMAGE_RANGE.y_end - IMAGE_RANGE.y_begin;
+
+	auto current_image = img::push_view(transient, width, height);
+	auto current_arena = img::push_arena(transient, IMAGE_ARENA_BYTES);
+	IntegralHist current_integral = {};
+
+	prefetch_start(transient);
+
+	check(dir::wait_for_file(image_stream, N_FIXTURE_IMAGES) == N_FIXTURE_IMAGES, "every fixture image is listed");
+
+	// the first image is loaded while the ui is idle
+	wait_until_ready(0);
+
+	auto first_file = dir::get_file(image_stream, 0);
+	auto slot_pixels = prefetch_queue.slots[0].image.image_data;
+
+	// a take that decoded the file again would not find it
+	fs::remove(first_file);
+
+	auto begin = clock_type::now();
+	auto has_image = prefetch_take(0, current_image, current_integral, current_arena);
+	auto first_ms = elapsed_ms(begin);
+
+	check(has_image, "a prefetched image is taken after its file is gone");
+	check(current_image.image_data == slot_pixels, "a prefetched image is swapped in, not copied or decoded");
+	check(has_color(current_image, fixture_color(fixture_index(first_file))), "a prefetched image has the pixels of its file");
+
+	printf("prefetched take: %.3f ms\n", first_ms);
+
+	// paging without waiting, some images may still be loading
+	double total_ms = 0.0;
+	double max_ms = 0.0;
+
+	for (u32 i = 1; i < N_FIXTURE_IMAGES; ++i)
+	{
+		auto file = dir::get_file(image_stream, i);
+
+		begin = clock_type::now();
+		has_image = prefetch_take(i, current_image, current_integral, current_arena);
+		auto ms = elapsed_ms(begin);
+
+		total_ms += ms;
+		max_ms = std::max(max_ms, ms);
+
+		check(has_image, "every listed image is taken");
+		check(has_color(current_image, fixture_color(fixture_index(file))), "each image has the pixels of its file");
+	}
+
+	printf("next image: %.3f ms mean, %.3f ms max over %u images\n", total_ms / (N_FIXTURE_IMAGES - 1), max_ms, N_FIXTURE_IMAGES - 1);
+
+	prefetch_stop();
+	dir::stop_stream(image_stream);
+	img::stop_workers();
+
+	fs::remove_all(fixture_dir);
+
+	if (n_failed)
+	{
+		printf("%d checks failed\n", n_failed);
+		return 1;
+	}
+
+	printf("passed\n");
+
+	return 0;
+}
@@ -1,8 +1,39 @@
 #include "dirhelper.hpp"
 
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <fstream>
 #include <cassert>
 
+#ifdef __linux__
+
+#include <cerrno>
+#include <memory>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+
+#elif defined(_WIN32)
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+#endif // __linux__
+
 static fs::path empty_path()
 {
 	return fs::path();
@@ -24,74 +55,430 @@ static std::string file_extension(const char* extension)
 	return file_extension(std::string(extension));
 }
 
-namespace dirhelper
+#ifdef __linux__
+
+// directory entries are read in batches this large
+constexpr size_t DIR_BATCH_BYTES = 1 << 16;
+
+
+// layout of the records returned by getdents64
+typedef struct linux_dirent64_t
 {
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
 
-	static path_t get_first_file_of_type(path_t const& src_dir, std::string extension)
+} LinuxDirent64;
+
+
+// same as fs::path::has_extension() for a file name
+static bool has_extension(const char* name, size_t length)
+{
+	for (auto c = name + length - 1; c > name; --c)
 	{
-		// extenstion must begin with '.'
-		if (extension[0] != '.')
-			extension = "." + extension;
+		if (*c == '.')
+		{
+			return true;
+		}
+	}
 
-		if (!fs::exists(src_dir) || !fs::is_directory(src_dir))
+	return false;
+}
+
+
+// same as comparing fs::path::extension() for a file name
+static bool has_extension(const char* name, size_t length, const char* extension, size_t ext_length)
+{
+	return length > ext_length &&
+		std::memcmp(name + length - ext_length, extension, ext_length) == 0 &&
+		std::memchr(name + length - ext_length + 1, '.', ext_length - 1) == 0;
+}
+
+
+// calls entry_func(LinuxDirent64 const&) on each entry until it returns false
+template <class ENTRY_F>
+static void for_each_dirent(int dir_fd, ENTRY_F const& entry_func)
+{
+	auto buffer = std::make_unique<char[]>(DIR_BATCH_BYTES);
+
+	for (;;)
+	{
+		auto n_bytes = syscall(SYS_getdents64, dir_fd, buffer.get(), DIR_BATCH_BYTES);
+		if (n_bytes <= 0)
 		{
-			// handle error
-			return empty_path();
+			return;
 		}
 
-		auto const entry_match = [&](fs::path const& entry)
+		for (long offset = 0; offset < n_bytes;)
 		{
-			return fs::is_regular_file(entry) &&
-				entry.has_extension() &&
-				entry.extension() == extension;
+			auto& entry = *(LinuxDirent64*)(buffer.get() + offset);
+			offset += entry.d_reclen;
+
+			if (!entry_func(entry))
+			{
+				return;
+			}
+		}
+	}
+}
+
+
+// links are followed like fs::is_regular_file
+static bool is_regular_file(int dir_fd, LinuxDirent64 const& entry)
+{
+	switch (entry.d_type)
+	{
+	case DT_REG:
+		return true;
+
+	case DT_LNK:
+	case DT_UNKNOWN:
+	{
+		struct statx stx;
+		return statx(dir_fd, entry.d_name, AT_STATX_SYNC_AS_STAT, STATX_TYPE, &stx) == 0 && S_ISREG(stx.stx_mode);
+	}
+
+	default:
+		return false;
+	}
+}
+
+
+// links are not followed like fs::recursive_directory_iterator
+static bool is_directory(int dir_fd, LinuxDirent64 const& entry)
+{
+	auto name = entry.d_name;
+	if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+	{
+		return false;
+	}
+
+	switch (entry.d_type)
+	{
+	case DT_DIR:
+		return true;
+
+	case DT_UNKNOWN:
+	{
+		struct statx stx;
+		return statx(dir_fd, name, AT_STATX_SYNC_AS_STAT | AT_SYMLINK_NOFOLLOW, STATX_TYPE, &stx) == 0 && S_ISDIR(stx.stx_mode);
+	}
+
+	default:
+		return false;
+	}
+}
+
+#endif // __linux__
+
+
+// extensions begin with '.' and are lower case
+static std::vector<std::string> lower_case_extensions(std::vector<std::string> const& extensions)
+{
+	std::vector<std::string> lower;
+
+	for (auto ext : extensions)
+	{
+		if (ext.empty())
+		{
+			continue;
+		}
+
+		for (auto& c : ext)
+		{
+			c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+		}
+
+		lower.push_back(file_extension(ext));
+	}
+
+	return lower;
+}
+
+
+// case insensitive compare of fs::path::extension() for a file name
+// no extensions matches any file with an extension
+template <class C>
+static bool extension_match(C const* name, size_t length, std::vector<std::string> const& extensions)
+{
+	size_t dot = length;
+	while (--dot > 0 && name[dot] != '.') {}
+
+	if (dot == 0)
+	{
+		return false;
+	}
+
+	if (extensions.empty())
+	{
+		return true;
+	}
+
+	auto ext_length = length - dot;
+
+	auto const lower = [](C c) { return (c >= 'A' && c <= 'Z') ? static_cast<C>(c - 'A' + 'a') : c; };
+
+	for (auto const& ext : extensions)
+	{
+		if (ext.size() != ext_length)
+		{
+			continue;
+		}
+
+		size_t i = 0;
+		while (i < ext_length && lower(name[dot + i]) == static_cast<C>(ext[i])) { ++i; }
+
+		if (i == ext_length)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+namespace dirhelper
+{
+	static parallel_for_t parallel_for_func;
+
+
+	void set_parallel_for(parallel_for_t const& func)
+	{
+		parallel_for_func = func;
+	}
+
+
+	// func(size_t i) is called for each i in [0, count) on the threads given to set_parallel_for
+	template <class INDEX_F>
+	static void for_each_index(size_t count, INDEX_F const& func)
+	{
+		assert(count <= UINT32_MAX);
+
+		auto const run_range = [&](uint32_t begin, uint32_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				func(i);
+			}
 		};
 
-		for (auto const& entry : fs::directory_iterator(src_dir))
+		if (!parallel_for_func || count < 2)
 		{
-			if (entry_match(entry))
-				return entry.path();
+			run_range(0, static_cast<uint32_t>(count));
+			return;
 		}
 
-		return empty_path();
+		parallel_for_func(0, static_cast<uint32_t>(count), run_range);
 	}
 
 
-	file_list_t get_all_files(path_t const& src_dir)
+	void packed_file_list_t::push_back(char_t const* name, size_t length)
 	{
-		file_list_t file_list;
+		assert(names.size() + length + 1 <= UINT32_MAX);
 
-		if (!fs::exists(src_dir) || !fs::is_directory(src_dir))
+		offsets.push_back(static_cast<uint32_t>(names.size()));
+		names.insert(names.end(), name, name + length);
+		names.push_back(0);
+	}
+
+
+#ifdef __linux__
+
+	// reads raw directory entries without a stat or allocation per entry
+	// extension == nullptr matches any file with an extension
+	// name_func(const char* name, size_t length) is called on each file until it returns false
+	template <class NAME_F>
+	static void scan_files(path_t const& src_dir, const char* extension, NAME_F const& name_func)
+	{
+		int dir_fd = open(src_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dir_fd < 0)
 		{
 			// handle error
-			return file_list;
+			return;
 		}
 
-		auto const entry_match = [&](fs::path const& entry)
+		auto ext_length = extension ? std::strlen(extension) : 0;
+
+		for_each_dirent(dir_fd, [&](LinuxDirent64 const& entry)
 		{
-			return fs::is_regular_file(entry) &&
-				entry.has_extension();
-		};
+			auto length = std::strlen(entry.d_name);
 
-		for (auto const& entry : fs::directory_iterator(src_dir))
+			auto name_match = extension ?
+				has_extension(entry.d_name, length, extension, ext_length) :
+				has_extension(entry.d_name, length);
+
+			if (name_match && is_regular_file(dir_fd, entry))
+			{
+				return name_func(entry.d_name, length);
+			}
+
+			return true;
+		});
+
+		close(dir_fd);
+	}
+
+#endif // __linux__
+
+
+	// one directory of a recursive scan
+	typedef struct dir_scan_t
+	{
+		path_t rel_dir;           // relative to the top directory
+		file_list_t files;        // names relative to the top directory
+		std::vector<path_t> dirs; // subdirectories relative to the top directory
+
+	} DirScan;
+
+
+	static void scan_dir(path_t const& src_dir, DirScan& scan, std::vector<std::string> const& extensions, bool descend)
+	{
+		auto dir = src_dir / scan.rel_dir;
+
+#ifdef __linux__
+
+		int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dir_fd < 0)
 		{
-			if (entry_match(entry))
-				file_list.push_back(entry.path());
+			// handle error
+			return;
 		}
 
-		return file_list;
+		std::string name = scan.rel_dir.empty() ? "" : scan.rel_dir.native() + '/';
+		auto prefix_length = name.size();
+
+		for_each_dirent(dir_fd, [&](LinuxDirent64 const& entry)
+		{
+			auto length = std::strlen(entry.d_name);
+
+			if (descend && is_directory(dir_fd, entry))
+			{
+				scan.dirs.push_back(scan.rel_dir / entry.d_name);
+			}
+			else if (extension_match(entry.d_name, length, extensions) && is_regular_file(dir_fd, entry))
+			{
+				name.resize(prefix_length);
+				name.append(entry.d_name, length);
+				scan.files.push_back(name.c_str(), name.size());
+			}
+
+			return true;
+		});
+
+		close(dir_fd);
+
+#else
+
+		std::error_code ec;
+
+		for (auto const& entry : fs::directory_iterator(dir, ec))
+		{
+			auto file_name = entry.path().filename();
+
+			if (descend && entry.is_directory() && !entry.is_symlink())
+			{
+				scan.dirs.push_back(scan.rel_dir / file_name);
+			}
+			else if (extension_match(file_name.c_str(), file_name.native().size(), extensions) && entry.is_regular_file())
+			{
+				scan.files.push_back(scan.rel_dir / file_name);
+			}
+		}
+
+#endif // __linux__
 	}
 
 
-	file_list_t get_files_of_type(path_t const& src_dir, const char* ext)
+	// directories list their entries in any order
+	static void sort_names(file_list_t& file_list)
 	{
-		auto extension = file_extension(ext);
+		using name_t = std::basic_string_view<char_t>;
+
+		auto const name = [&](uint32_t offset) { return name_t(file_list.names.data() + offset); };
+
+		auto offsets = file_list.offsets;
+		std::sort(offsets.begin(), offsets.end(), [&](uint32_t a, uint32_t b) { return name(a) < name(b); });
+
+		file_list_t sorted;
+		sorted.directory = std::move(file_list.directory);
+		sorted.names.reserve(file_list.names.size());
+		sorted.offsets.reserve(offsets.size());
 
+		for (auto offset : offsets)
+		{
+			auto n = name(offset);
+			sorted.push_back(n.data(), n.size());
+		}
+
+		file_list = std::move(sorted);
+	}
+
+
+	file_list_t get_files_recursive(path_t const& src_dir, scan_options_t const& options)
+	{
 		file_list_t file_list;
+		file_list.directory = src_dir;
+
+		auto extensions = lower_case_extensions(options.extensions);
+
+		std::vector<DirScan> level(1);
+
+		for (uint32_t depth = 0; !level.empty(); ++depth)
+		{
+			auto descend = depth < options.max_depth;
+
+			// the directories of a level are scanned in parallel
+			for_each_index(level.size(), [&](size_t i)
+			{
+				auto& scan = level[i];
+				scan_dir(src_dir, scan, extensions, descend);
+
+				sort_names(scan.files);
+				std::sort(scan.dirs.begin(), scan.dirs.end());
+			});
+
+			std::vector<DirScan> next_level;
+
+			for (auto& scan : level)
+			{
+				for (size_t i = 0; i < scan.files.size(); ++i)
+				{
+					if (file_list.size() >= options.max_files)
+					{
+						return file_list;
+					}
+
+					auto name = scan.files.name(i);
+					file_list.push_back(name, std::char_traits<char_t>::length(name));
+				}
+
+				for (auto& dir : scan.dirs)
+				{
+					next_level.emplace_back();
+					next_level.back().rel_dir = std::move(dir);
+				}
+			}
+
+			level = std::move(next_level);
+		}
+
+		return file_list;
+	}
+
+
+	static path_t get_first_file_of_type(path_t const& src_dir, std::string extension)
+	{
+		// extenstion must begin with '.'
+		if (extension[0] != '.')
+			extension = "." + extension;
 
 		if (!fs::exists(src_dir) || !fs::is_directory(src_dir))
 		{
 			// handle error
-			return file_list;
+			return empty_path();
 		}
 
 		auto const entry_match = [&](fs::path const& entry)
@@ -104,16 +491,44 @@ namespace dirhelper
 		for (auto const& entry : fs::directory_iterator(src_dir))
 		{
 			if (entry_match(entry))
-				file_list.push_back(entry.path());
+				return entry.path();
 		}
 
-		return file_list;
+		return empty_path();
+	}
+
+
+	file_list_t get_all_files(path_t const& src_dir)
+	{
+		return get_all_files(src_dir, SIZE_MAX);
+	}
+
+
+	file_list_t get_files_of_type(path_t const& src_dir, const char* ext)
+	{
+		return get_files_of_type(src_dir, ext, SIZE_MAX);
 	}
 
 
 	file_list_t get_all_files(path_t const& src_dir, size_t max_size)
 	{
 		file_list_t file_list;
+		file_list.directory = src_dir;
+
+#ifdef __linux__
+
+		if (max_size)
+		{
+			scan_files(src_dir, nullptr, [&](const char* name, size_t length)
+			{
+				file_list.push_back(name, length);
+				return file_list.size() < max_size;
+			});
+		}
+
+		return file_list;
+
+#else
 
 		if (!fs::exists(src_dir) || !fs::is_directory(src_dir))
 		{
@@ -138,12 +553,13 @@ namespace dirhelper
 
 			if (entry_match(entry))
 			{
-				file_list.push_back(entry.path());
+				file_list.push_back(entry.path().filename());
 				++size;
 			}
 		}
 
 		return file_list;
+#endif // __linux__
 	}
 
 
@@ -152,6 +568,22 @@ namespace dirhelper
 		auto extension = file_extension(ext);
 
 		file_list_t file_list;
+		file_list.directory = src_dir;
+
+#ifdef __linux__
+
+		if (max_size)
+		{
+			scan_files(src_dir, extension.c_str(), [&](const char* name, size_t length)
+			{
+				file_list.push_back(name, length);
+				return file_list.size() < max_size;
+			});
+		}
+
+		return file_list;
+
+#else
 
 		if (!fs::exists(src_dir) || !fs::is_directory(src_dir))
 		{
@@ -177,40 +609,1428 @@ namespace dirhelper
 
 			if (entry_match(entry))
 			{
-				file_list.push_back(entry.path());
+				file_list.push_back(entry.path().filename());
 				++size;
 			}
 
 		}
 
 		return file_list;
+#endif // __linux__
 	}
 
 
-	path_t get_first_file_of_type(path_t const& src_dir, const char* extension)
-	{
-		return get_first_file_of_type(src_dir, std::string(extension));
-	}
+	//======= SCAN CACHE =================
 
+	constexpr uint32_t SCAN_CACHE_MAGIC = 0x4E414353; // "SCAN"
+	constexpr uint32_t SCAN_CACHE_VERSION = 2;
 
-	void process_files(file_list_t const& files, file_func_t const& func)
-	{
-		for (auto const& file : files)
-			func(file);
-	}
+	// the coarsest mtime kept by a filesystem, FAT keeps 2 seconds
+	constexpr int64_t MTIME_GRANULE_NS = 2000000000;
 
 
-	void move_file(path_t const& file, path_t const& dst_dir)
+	// a directory changes its mtime when files are added, removed or renamed in it
+	typedef struct dir_stamp_t
 	{
-		if (!fs::is_regular_file(file) || !fs::is_directory(dst_dir))
-		{
-			return;
+		uint64_t inode;
+		int64_t mtime_ns;
+		int64_t stamped_ns; // when the stamp was taken, on the clock of mtime_ns
+
+	} DirStamp;
+
+
+	// followed by the directory, the extension, the offsets and the names
+	typedef struct scan_cache_header_t
+	{
+		uint32_t magic;
+		uint32_t version;
+
+		DirStamp stamp;
+
+		uint32_t char_size;
+		uint32_t directory_length;
+		uint32_t extension_length;
+		uint32_t n_files;
+		uint64_t names_size;
+
+	} ScanCacheHeader;
+
+
+	static bool get_dir_stamp(path_t const& dir, DirStamp& stamp)
+	{
+#ifdef __linux__
+
+		struct statx stx;
+		if (statx(AT_FDCWD, dir.c_str(), AT_STATX_SYNC_AS_STAT, STATX_INO | STATX_MTIME, &stx) != 0 || !S_ISDIR(stx.stx_mode))
+		{
+			return false;
+		}
+
+		timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		stamp.inode = stx.stx_ino;
+		stamp.mtime_ns = static_cast<int64_t>(stx.stx_mtime.tv_sec) * 1000000000 + stx.stx_mtime.tv_nsec;
+		stamp.stamped_ns = static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+
+#else
+
+		std::error_code ec;
+		auto mtime = fs::last_write_time(dir, ec);
+		if (ec || !fs::is_directory(dir, ec))
+		{
+			return false;
+		}
+
+		auto now = fs::file_time_type::clock::now();
+
+		stamp.inode = 0;
+		stamp.mtime_ns = static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count());
+		stamp.stamped_ns = static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count());
+
+#endif // __linux__
+
+		return true;
+	}
+
+
+	// calls read_func(const char* data, size_t size) with the contents of the file
+	template <class READ_F>
+	static bool read_file(path_t const& file, READ_F const& read_func)
+	{
+#ifdef __linux__
+
+		int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size <= 0)
+		{
+			close(fd);
+			return false;
+		}
+
+		auto size = static_cast<size_t>(st.st_size);
+		auto data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if (data == MAP_FAILED)
+		{
+			return false;
+		}
+
+		auto result = read_func((const char*)data, size);
+		munmap(data, size);
+
+		return result;
+
+#else
+
+		std::ifstream in(file, std::ios::binary | std::ios::ate);
+		if (!in)
+		{
+			return false;
+		}
+
+		auto size = static_cast<size_t>(in.tellg());
+		std::vector<char> data(size);
+
+		in.seekg(0);
+		if (!in.read(data.data(), size))
+		{
+			return false;
+		}
+
+		return read_func(data.data(), size);
+
+#endif // __linux__
+	}
+
+
+	// copies a cached listing to the stream if the directory has not changed since
+	// a file added in the same mtime granule as the listing would not change the mtime
+	static bool load_scan_cache(file_stream_t& stream, std::string const& extension, DirStamp const& stamp, size_t& n_files, size_t& names_size)
+	{
+		auto& directory = stream.directory.native();
+		auto& listing = *stream.listing;
+
+		return read_file(stream.cache_path, [&](const char* data, size_t size)
+		{
+			ScanCacheHeader header;
+			if (size < sizeof(header))
+			{
+				return false;
+			}
+
+			std::memcpy(&header, data, sizeof(header));
+
+			auto dir_bytes = static_cast<size_t>(header.directory_length) * sizeof(char_t);
+			auto offsets_bytes = static_cast<size_t>(header.n_files) * sizeof(uint32_t);
+			auto names_bytes = header.names_size * sizeof(char_t);
+
+			// sizes are checked before they are added up
+			if (header.magic != SCAN_CACHE_MAGIC ||
+				header.version != SCAN_CACHE_VERSION ||
+				header.stamp.inode != stamp.inode ||
+				header.stamp.mtime_ns != stamp.mtime_ns ||
+				header.stamp.stamped_ns - header.stamp.mtime_ns < MTIME_GRANULE_NS ||
+				header.char_size != sizeof(char_t) ||
+				header.directory_length != directory.size() ||
+				header.extension_length != extension.size() ||
+				header.n_files > listing.max_files ||
+				header.names_size > listing.names_capacity ||
+				size != sizeof(header) + dir_bytes + header.extension_length + offsets_bytes + names_bytes)
+			{
+				return false;
+			}
+
+			auto dir_data = data + sizeof(header);
+			auto ext_data = dir_data + dir_bytes;
+			auto offsets_data = ext_data + header.extension_length;
+			auto names_data = offsets_data + offsets_bytes;
+
+			if (std::memcmp(dir_data, directory.data(), dir_bytes) != 0 ||
+				std::memcmp(ext_data, extension.data(), extension.size()) != 0)
+			{
+				return false;
+			}
+
+			std::memcpy(listing.offsets, offsets_data, offsets_bytes);
+			std::memcpy(listing.names, names_data, names_bytes);
+
+			auto n_cached = static_cast<size_t>(header.n_files);
+			auto cached_size = static_cast<size_t>(header.names_size);
+
+			// a damaged cache must not point outside of the names
+			// every name ends inside the buffer if the last character is a null
+			if (cached_size && listing.names[cached_size - 1] != 0)
+			{
+				return false;
+			}
+
+			for (size_t i = 0; i < n_cached; ++i)
+			{
+				if (listing.offsets[i] >= cached_size)
+				{
+					return false;
+				}
+			}
+
+			n_files = n_cached;
+			names_size = cached_size;
+
+			return true;
+		});
+	}
+
+
+	// written to a temporary file first so a cache is never partly written
+	static void save_scan_cache(file_stream_t const& stream, std::string const& extension, DirStamp const& stamp, size_t n_files, size_t names_size)
+	{
+		auto& directory = stream.directory.native();
+
+		ScanCacheHeader header = {};
+		header.magic = SCAN_CACHE_MAGIC;
+		header.version = SCAN_CACHE_VERSION;
+		header.stamp = stamp;
+		header.char_size = sizeof(char_t);
+		header.directory_length = static_cast<uint32_t>(directory.size());
+		header.extension_length = static_cast<uint32_t>(extension.size());
+		header.n_files = static_cast<uint32_t>(n_files);
+		header.names_size = names_size;
+
+		auto temp_path = stream.cache_path;
+		temp_path += ".tmp";
+
+		{
+			std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+			if (!out)
+			{
+				return;
+			}
+
+			out.write((const char*)&header, sizeof(header));
+			out.write((const char*)directory.data(), directory.size() * sizeof(char_t));
+			out.write(extension.data(), extension.size());
+			out.write((const char*)stream.listing->offsets, n_files * sizeof(uint32_t));
+			out.write((const char*)stream.listing->names, names_size * sizeof(char_t));
+
+			if (!out)
+			{
+				return;
+			}
+		}
+
+		std::error_code ec;
+		fs::rename(temp_path, stream.cache_path, ec);
+	}
+
+
+	//======= FILE STREAM ================
+
+	// files are published to the consumer in batches up to this size
+	constexpr size_t STREAM_MAX_BATCH = 4096;
+
+
+#ifdef __linux__
+
+	// how often a watching stream checks if it has been stopped
+	constexpr int WATCH_POLL_MS = 100;
+
+
+	// files closed after writing or moved in are added, files deleted or moved out are marked removed
+	// push_name(const char* name, size_t length) adds a file, publish() makes added files readable
+	template <class PUSH_F, class PUBLISH_F>
+	static void watch_files(file_stream_t& stream, int watch_fd, std::string const& extension, size_t const& n_files, PUSH_F const& push_name, PUBLISH_F const& publish)
+	{
+		using name_t = std::basic_string_view<char_t>;
+
+		auto& listing = *stream.listing;
+
+		// names are in stream memory that never moves
+		std::unordered_map<name_t, uint32_t> indices;
+		indices.reserve(n_files);
+
+		for (uint32_t i = 0; i < n_files; ++i)
+		{
+			indices[name_t(listing.names + listing.offsets[i])] = i;
+		}
+
+		auto buffer = std::make_unique<char[]>(DIR_BATCH_BYTES);
+
+		while (!stream.stopping)
+		{
+			pollfd poll_fd = { watch_fd, POLLIN, 0 };
+			if (poll(&poll_fd, 1, WATCH_POLL_MS) <= 0)
+			{
+				continue;
+			}
+
+			auto n_bytes = read(watch_fd, buffer.get(), DIR_BATCH_BYTES);
+			if (n_bytes <= 0)
+			{
+				continue;
+			}
+
+			auto n_before = n_files;
+
+			for (long offset = 0; offset < n_bytes;)
+			{
+				auto& event = *(inotify_event*)(buffer.get() + offset);
+				offset += sizeof(inotify_event) + event.len;
+
+				if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+				{
+					return;
+				}
+
+				if (!event.len || (event.mask & IN_ISDIR))
+				{
+					continue;
+				}
+
+				auto length = std::strlen(event.name);
+				if (!has_extension(event.name, length, extension.c_str(), extension.size()))
+				{
+					continue;
+				}
+
+				auto found = indices.find(name_t(event.name, length));
+
+				if (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+				{
+					// also sent for files listed while the watch was starting
+					if (found == indices.end() && push_name(event.name, length))
+					{
+						auto index = static_cast<uint32_t>(n_files - 1);
+						indices[name_t(listing.names + listing.offsets[index], length)] = index;
+					}
+				}
+				else if (found != indices.end())
+				{
+					{
+						std::lock_guard<std::mutex> lock(stream.mutex);
+
+						listing.removed[found->second / 64] |= 1ull << (found->second % 64);
+					}
+
+					indices.erase(found);
+				}
+			}
+
+			if (n_files != n_before)
+			{
+				publish();
+			}
+		}
+	}
+
+#endif // __linux__
+
+
+	static void produce_files(file_stream_t& stream, std::string const& extension)
+	{
+		auto& listing = *stream.listing;
+
+		size_t n_files = 0;
+		size_t n_published = 0;
+		size_t names_size = 0;
+		size_t batch = 1;
+		bool is_full = false;
+		bool is_stopped = false;
+		bool is_listed = false;
+
+		auto const publish = [&]()
+		{
+			{
+				std::lock_guard<std::mutex> lock(stream.mutex);
+
+				listing.n_listed = n_files;
+				listing.complete = is_listed;
+			}
+
+			stream.cv.notify_all();
+
+			if (stream.on_listed)
+			{
+				stream.on_listed();
+			}
+
+			n_published = n_files;
+			batch = std::min(batch * 2, STREAM_MAX_BATCH);
+		};
+
+		// returns false when listing should end
+		auto const push_name = [&](char_t const* name, size_t length)
+		{
+			if (n_files == listing.max_files || names_size + length + 1 > listing.names_capacity)
+			{
+				is_full = true;
+				return false;
+			}
+
+			listing.offsets[n_files] = static_cast<uint32_t>(names_size);
+			std::copy(name, name + length, listing.names + names_size);
+			listing.names[names_size + length] = 0;
+
+			names_size += length + 1;
+			++n_files;
+
+			if (n_files - n_published >= batch)
+			{
+				publish();
+			}
+
+			is_stopped = stream.stopping;
+
+			return !is_stopped;
+		};
+
+#ifdef __linux__
+
+		// watched before listing so that no file written during the listing is missed
+		int watch_fd = -1;
+		if (stream.watch)
+		{
+			watch_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+
+			auto mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+			if (watch_fd >= 0 && inotify_add_watch(watch_fd, stream.directory.c_str(), mask) < 0)
+			{
+				close(watch_fd);
+				watch_fd = -1;
+			}
+		}
+
+#endif // __linux__
+
+		// stamped before scanning so that changes made during the scan invalidate the cache
+		DirStamp stamp = {};
+		auto use_cache = !stream.cache_path.empty() && get_dir_stamp(stream.directory, stamp);
+		auto from_cache = use_cache && load_scan_cache(stream, extension, stamp, n_files, names_size);
+
+		if (!from_cache)
+		{
+#ifdef __linux__
+
+			scan_files(stream.directory, extension.c_str(), push_name);
+
+#else
+
+			std::error_code ec;
+
+			for (auto const& entry : fs::directory_iterator(stream.directory, ec))
+			{
+				auto file_name = entry.path().filename();
+
+				if (entry.is_regular_file() && file_name.has_extension() && file_name.extension() == extension &&
+					!push_name(file_name.c_str(), file_name.native().size()))
+				{
+					break;
+				}
+			}
+
+#endif // __linux__
+		}
+
+		is_listed = true;
+		publish();
+
+		// saved even when stopped now, the next start reads it
+		if (use_cache && !from_cache && !is_full && !is_stopped)
+		{
+			save_scan_cache(stream, extension, stamp, n_files, names_size);
+		}
+
+#ifdef __linux__
+
+		if (watch_fd >= 0)
+		{
+			watch_files(stream, watch_fd, extension, n_files, push_name, publish);
+			close(watch_fd);
+		}
+
+#endif // __linux__
+	}
+
+
+	file_stream_t::~file_stream_t()
+	{
+		// stop_stream was not called
+		assert(!producer.joinable());
+
+		if (producer.joinable())
+		{
+			stopping = true;
+			producer.detach();
+		}
+	}
+
+
+	void start_files_of_type(file_stream_t& stream, path_t const& src_dir, const char* extension)
+	{
+		assert(!stream.producer.joinable());
+		assert(stream.listing);
+
+		auto& listing = *stream.listing;
+
+		assert(listing.names);
+		assert(listing.offsets);
+		assert(listing.removed);
+		assert(listing.names_capacity <= UINT32_MAX);
+
+		stream.directory = src_dir;
+		stream.stopping = false;
+
+		listing.n_listed = 0;
+		listing.complete = false;
+		std::fill(listing.removed, listing.removed + removed_words(listing.max_files), 0);
+
+		stream.producer = std::thread(produce_files, std::ref(stream), file_extension(extension));
+	}
+
+
+	size_t files_listed(file_stream_t& stream)
+	{
+		std::lock_guard<std::mutex> lock(stream.mutex);
+
+		return stream.listing->n_listed;
+	}
+
+
+	size_t wait_for_file(file_stream_t& stream, size_t index)
+	{
+		auto& listing = *stream.listing;
+
+		std::unique_lock<std::mutex> lock(stream.mutex);
+
+		stream.cv.wait(lock, [&]() { return index < listing.n_listed || listing.complete; });
+
+		return listing.n_listed;
+	}
+
+
+	path_t get_file(file_stream_t const& stream, size_t index)
+	{
+		auto& listing = *stream.listing;
+
+		return stream.directory / (listing.names + listing.offsets[index]);
+	}
+
+
+	bool file_removed(file_stream_t& stream, size_t index)
+	{
+		std::lock_guard<std::mutex> lock(stream.mutex);
+
+		return (stream.listing->removed[index / 64] >> (index % 64)) & 1;
+	}
+
+
+	void stop_stream(file_stream_t& stream)
+	{
+		stream.stopping = true;
+
+		if (stream.producer.joinable())
+		{
+			stream.producer.join();
+		}
+	}
+
+
+	path_t get_first_file_of_type(path_t const& src_dir, const char* extension)
+	{
+		return get_first_file_of_type(src_dir, std::string(extension));
+	}
+
+
+	void process_files(file_list_t const& files, file_func_t const& func)
+	{
+		for (auto const& file : files)
+			func(file);
+	}
+
+
+	//======= MOVE FILES =================
+
+#ifdef __linux__
+
+	// copies in the kernel with copy_file_range, or with sendfile where that is not supported
+	static bool copy_file_data(int src_fd, int dst_fd, size_t size)
+	{
+		size_t copied = 0;
+		bool use_sendfile = false;
+
+		while (copied < size)
+		{
+			auto n_bytes = use_sendfile ?
+				sendfile(dst_fd, src_fd, 0, size - copied) :
+				copy_file_range(src_fd, 0, dst_fd, 0, size - copied, 0);
+
+			if (n_bytes < 0 && !use_sendfile && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP))
+			{
+				use_sendfile = true;
+				continue;
+			}
+
+			if (n_bytes < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			if (n_bytes <= 0)
+			{
+				return false;
+			}
+
+			copied += static_cast<size_t>(n_bytes);
+		}
+
+		return true;
+	}
+
+#endif // __linux__
+
+
+	// the copy is synced before the file is removed
+	static bool copy_and_remove(path_t const& file, path_t const& dst)
+	{
+#ifdef __linux__
+
+		int src_fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+		if (src_fd < 0)
+		{
+			return false;
+		}
+
+		struct stat st;
+		if (fstat(src_fd, &st) != 0)
+		{
+			close(src_fd);
+			return false;
+		}
+
+		int dst_fd = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+		if (dst_fd < 0)
+		{
+			close(src_fd);
+			return false;
+		}
+
+		auto result = copy_file_data(src_fd, dst_fd, static_cast<size_t>(st.st_size)) && fsync(dst_fd) == 0;
+
+		close(src_fd);
+		result = close(dst_fd) == 0 && result;
+
+		if (!result)
+		{
+			unlink(dst.c_str());
+			return false;
+		}
+
+		return unlink(file.c_str()) == 0;
+
+#else
+
+		std::error_code ec;
+
+		if (!fs::copy_file(file, dst, fs::copy_options::overwrite_existing, ec))
+		{
+			fs::remove(dst, ec);
+			return false;
+		}
+
+		return fs::remove(file, ec);
+
+#endif // __linux__
+	}
+
+
+	static MoveStatus move_one_file(path_t const& file, path_t const& dst_dir)
+	{
+		std::error_code ec;
+
+		if (!fs::is_regular_file(file, ec) || !fs::is_directory(dst_dir, ec))
+		{
+			return MoveStatus::Failed;
+		}
+
+		auto dst = dst_dir / file.filename();
+
+		fs::rename(file, dst, ec);
+		if (!ec)
+		{
+			return MoveStatus::Moved;
+		}
+
+		if (ec != std::errc::cross_device_link)
+		{
+			return MoveStatus::Failed;
+		}
+
+		return copy_and_remove(file, dst) ? MoveStatus::Copied : MoveStatus::Failed;
+	}
+
+
+	void move_file(path_t const& file, path_t const& dst_dir)
+	{
+		move_one_file(file, dst_dir);
+	}
+
+
+#ifdef __linux__
+
+	// shares the data of file until either is changed, on filesystems that support it
+	static bool clone_file(path_t const& file, path_t const& dst)
+	{
+		int src_fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+		if (src_fd < 0)
+		{
+			return false;
+		}
+
+		struct stat st;
+		int dst_fd = fstat(src_fd, &st) == 0 ? open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777) : -1;
+		if (dst_fd < 0)
+		{
+			close(src_fd);
+			return false;
+		}
+
+		auto result = ioctl(dst_fd, FICLONE, src_fd) == 0;
+
+		close(src_fd);
+		close(dst_fd);
+
+		if (!result)
+		{
+			unlink(dst.c_str());
+		}
+
+		return result;
+	}
+
+#endif // __linux__
+
+
+	static MoveStatus link_one_file(path_t const& file, path_t const& dst_dir)
+	{
+		std::error_code ec;
+
+		if (!fs::is_regular_file(file, ec) || !fs::is_directory(dst_dir, ec))
+		{
+			return MoveStatus::Failed;
+		}
+
+		auto dst = dst_dir / file.filename();
+
+		fs::create_hard_link(file, dst, ec);
+		if (!ec)
+		{
+			return MoveStatus::Linked;
+		}
+
+		if (ec == std::errc::file_exists)
+		{
+			return MoveStatus::Failed;
+		}
+
+#ifdef __linux__
+
+		// e.g. too many links or links not permitted
+		return clone_file(file, dst) ? MoveStatus::Cloned : MoveStatus::Failed;
+
+#else
+
+		return MoveStatus::Failed;
+
+#endif // __linux__
+	}
+
+
+	static MoveStatus run_move(FileMove const& move)
+	{
+		return move.link ? link_one_file(move.file, move.dst_dir) : move_one_file(move.file, move.dst_dir);
+	}
+
+
+	//======= MOVE JOURNAL ===============
+
+	// the same file keeps its id when it is renamed
+	typedef struct file_id_t
+	{
+		uint64_t device;
+		uint64_t index; // 0 if not known on this platform
+
+	} FileId;
+
+
+	// returns false if there is no file
+	static bool get_file_id(path_t const& file, FileId& id)
+	{
+		id = {};
+
+#ifdef __linux__
+
+		struct stat st;
+		if (lstat(file.c_str(), &st) != 0)
+		{
+			return false;
+		}
+
+		id.device = static_cast<uint64_t>(st.st_dev);
+		id.index = static_cast<uint64_t>(st.st_ino);
+
+		return true;
+
+#elif defined(_WIN32)
+
+		auto handle = CreateFileW(file.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, 0);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		BY_HANDLE_FILE_INFORMATION info;
+		auto result = GetFileInformationByHandle(handle, &info) != 0;
+		CloseHandle(handle);
+
+		if (result)
+		{
+			id.device = info.dwVolumeSerialNumber;
+			id.index = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+		}
+
+		return result;
+
+#else
+
+		std::error_code ec;
+		return fs::exists(file, ec);
+
+#endif // __linux__
+	}
+
+
+	enum class RecordKind : uint32_t
+	{
+		Intent, // synced before the move
+		Done,   // synced after the move succeeded
+	};
+
+
+	// followed by the file and its destination
+	typedef struct journal_record_t
+	{
+		int64_t time_ns;
+		FileId dst_id; // done, the file the move left at the destination
+		uint32_t file_length;
+		uint32_t dst_length;
+		uint32_t link;
+		RecordKind kind;
+		uint32_t dst_existed; // intent, another file was at the destination before the move
+		uint32_t padding;
+
+	} JournalRecord;
+
+
+	// a journaled move and how to undo it
+	typedef struct undo_entry_t
+	{
+		path_t file;    // where the move put the file
+		path_t src_dir; // where it was moved from
+		FileId dst_id;
+		bool link;
+		bool dst_existed;
+		bool done; // false if a crash came before the done record was synced
+
+	} UndoEntry;
+
+
+	static void push_record(std::vector<char>& data, FileMove const& move, JournalRecord record)
+	{
+		auto& file = move.file.native();
+		auto dst = (move.dst_dir / move.file.filename()).native();
+
+		record.time_ns = static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count());
+		record.file_length = static_cast<uint32_t>(file.size());
+		record.dst_length = static_cast<uint32_t>(dst.size());
+		record.link = move.link;
+
+		auto begin = (const char*)&record;
+		data.insert(data.end(), begin, begin + sizeof(record));
+
+		begin = (const char*)file.data();
+		data.insert(data.end(), begin, begin + file.size() * sizeof(char_t));
+
+		begin = (const char*)dst.data();
+		data.insert(data.end(), begin, begin + dst.size() * sizeof(char_t));
+	}
+
+
+	static void push_intent(std::vector<char>& data, FileMove const& move)
+	{
+		std::error_code ec;
+
+		JournalRecord record = {};
+		record.kind = RecordKind::Intent;
+		record.dst_existed = fs::exists(move.dst_dir / move.file.filename(), ec);
+
+		push_record(data, move, record);
+	}
+
+
+	static void push_done(std::vector<char>& data, FileMove const& move)
+	{
+		JournalRecord record = {};
+		record.kind = RecordKind::Done;
+		get_file_id(move.dst_dir / move.file.filename(), record.dst_id);
+
+		push_record(data, move, record);
+	}
+
+
+#ifdef __linux__
+
+	// a new file is not durable until the directory entry is synced too
+	static bool sync_directory(path_t const& dir)
+	{
+		int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		auto result = fsync(fd) == 0;
+
+		return close(fd) == 0 && result;
+	}
+
+#endif // __linux__
+
+
+	// one sync for the whole batch
+	static bool append_journal(path_t const& journal_path, std::vector<char> const& data)
+	{
+#ifdef __linux__
+
+		bool created = false;
+
+		int fd = open(journal_path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+		if (fd < 0 && errno == ENOENT)
+		{
+			fd = open(journal_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+			created = true;
+		}
+
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		size_t written = 0;
+		while (written < data.size())
+		{
+			auto n_bytes = write(fd, data.data() + written, data.size() - written);
+			if (n_bytes < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			if (n_bytes <= 0)
+			{
+				close(fd);
+				return false;
+			}
+
+			written += static_cast<size_t>(n_bytes);
+		}
+
+		auto result = fdatasync(fd) == 0;
+		result = close(fd) == 0 && result;
+
+		return result && (!created || sync_directory(journal_path.parent_path()));
+
+#elif defined(_WIN32)
+
+		auto handle = CreateFileW(journal_path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, 0, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		size_t written = 0;
+		while (written < data.size())
+		{
+			auto size = static_cast<DWORD>(std::min(data.size() - written, static_cast<size_t>(MAXDWORD)));
+
+			DWORD n_bytes = 0;
+			if (!WriteFile(handle, data.data() + written, size, &n_bytes, 0) || n_bytes == 0)
+			{
+				CloseHandle(handle);
+				return false;
+			}
+
+			written += n_bytes;
+		}
+
+		auto result = FlushFileBuffers(handle) != 0;
+
+		return CloseHandle(handle) != 0 && result;
+
+#else
+
+		std::ofstream out(journal_path, std::ios::binary | std::ios::app);
+		out.write(data.data(), data.size());
+		out.flush();
+
+		return static_cast<bool>(out);
+
+#endif // __linux__
+	}
+
+
+	// a record cut short by a crash ends the journal
+	// moves without a done record are returned too, the move may have happened before the crash
+	static std::vector<UndoEntry> read_journal(path_t const& journal_path)
+	{
+		std::vector<UndoEntry> entries;
+
+		// moves not done yet by destination
+		std::unordered_map<path_t::string_type, size_t> pending;
+
+		read_file(journal_path, [&](const char* data, size_t size)
+		{
+			size_t offset = 0;
+
+			JournalRecord record;
+			while (offset + sizeof(record) <= size)
+			{
+				std::memcpy(&record, data + offset, sizeof(record));
+
+				auto file_bytes = static_cast<size_t>(record.file_length) * sizeof(char_t);
+				auto dst_bytes = static_cast<size_t>(record.dst_length) * sizeof(char_t);
+
+				if (offset + sizeof(record) + file_bytes + dst_bytes > size)
+				{
+					break;
+				}
+
+				offset += sizeof(record);
+
+				path_t::string_type file(record.file_length, 0);
+				std::memcpy(file.data(), data + offset, file_bytes);
+				offset += file_bytes;
+
+				path_t::string_type dst(record.dst_length, 0);
+				std::memcpy(dst.data(), data + offset, dst_bytes);
+				offset += dst_bytes;
+
+				if (record.kind == RecordKind::Done)
+				{
+					auto intent = pending.find(dst);
+					if (intent != pending.end())
+					{
+						auto& entry = entries[intent->second];
+						entry.dst_id = record.dst_id;
+						entry.done = true;
+						pending.erase(intent);
+					}
+
+					continue;
+				}
+
+				pending[dst] = entries.size();
+
+				UndoEntry entry = {};
+				entry.file = path_t(std::move(dst));
+				entry.src_dir = path_t(std::move(file)).parent_path();
+				entry.link = record.link != 0;
+				entry.dst_existed = record.dst_existed != 0;
+				entries.push_back(std::move(entry));
+			}
+
+			return true;
+		});
+
+		return entries;
+	}
+
+
+	// the file at the destination was put there by the journaled move
+	static bool is_journaled_file(UndoEntry const& entry)
+	{
+		std::error_code ec;
+
+		auto src = entry.src_dir / entry.file.filename();
+
+		if (!entry.done)
+		{
+			// a file that was there before the move is never taken for the moved one
+			// a clone cut short by a crash is left, it cannot be told from another file
+			if (entry.dst_existed || !fs::exists(entry.file, ec))
+			{
+				return false;
+			}
+
+			return entry.link ? fs::equivalent(entry.file, src, ec) : !fs::exists(src, ec);
+		}
+
+		FileId id;
+		if (!get_file_id(entry.file, id))
+		{
+			return false;
+		}
+
+		if (entry.dst_id.index)
+		{
+			return id.device == entry.dst_id.device && id.index == entry.dst_id.index;
+		}
+
+		// no file ids on this platform
+		return !entry.link || fs::equivalent(entry.file, src, ec);
+	}
+
+
+	static bool undo_entry(UndoEntry const& entry)
+	{
+		std::error_code ec;
+
+		if (!is_journaled_file(entry))
+		{
+			return false;
+		}
+
+		if (entry.link)
+		{
+			return fs::remove(entry.file, ec);
+		}
+
+		// a file of the same name has taken its place since
+		if (fs::exists(entry.src_dir / entry.file.filename(), ec))
+		{
+			return false;
+		}
+
+		return move_one_file(entry.file, entry.src_dir) != MoveStatus::Failed;
+	}
+
+
+	// keeps the order of the moves within each group
+	template <class IT, class DIR_F>
+	static auto group_moves(IT begin, IT end, DIR_F const& dir_func)
+	{
+		using move_t = typename std::iterator_traits<IT>::value_type;
+
+		std::vector<std::vector<move_t>> groups;
+
+		for (auto it = begin; it != end; ++it)
+		{
+			auto dir = dir_func(*it);
+
+			auto group = std::find_if(groups.begin(), groups.end(), [&](auto const& g) { return dir_func(g[0]) == dir; });
+			if (group == groups.end())
+			{
+				groups.emplace_back();
+				group = groups.end() - 1;
+			}
+
+			group->push_back(*it);
+		}
+
+		return groups;
+	}
+
+
+	// nothing is moved without a record of it
+	// moves are grouped by destination directory and the groups run on the threads given to set_parallel_for
+	static void run_batch(std::vector<FileMove> const& moves, std::vector<MoveStatus>& status, path_t const& journal_path)
+	{
+		status.assign(moves.size(), MoveStatus::Failed);
+
+		if (!journal_path.empty())
+		{
+			std::vector<char> journal_data;
+			for (auto const& move : moves)
+			{
+				push_intent(journal_data, move);
+			}
+
+			if (!append_journal(journal_path, journal_data))
+			{
+				return;
+			}
+		}
+
+		std::vector<size_t> indices(moves.size());
+		for (size_t i = 0; i < moves.size(); ++i)
+		{
+			indices[i] = i;
+		}
+
+		auto groups = group_moves(indices.begin(), indices.end(), [&](size_t i) { return moves[i].dst_dir; });
+
+		std::mutex journal_mutex;
+
+		for_each_index(groups.size(), [&](size_t g)
+		{
+			std::vector<char> done_data;
+
+			for (auto i : groups[g])
+			{
+				status[i] = run_move(moves[i]);
+
+				if (status[i] != MoveStatus::Failed)
+				{
+					push_done(done_data, moves[i]);
+				}
+			}
+
+			// each directory is synced once when its moves are done
+			if (!journal_path.empty() && !done_data.empty())
+			{
+				std::lock_guard<std::mutex> lock(journal_mutex);
+				append_journal(journal_path, done_data);
+			}
+		});
+	}
+
+
+	size_t apply_moves(std::vector<FileMove> const& moves, path_t const& journal_path)
+	{
+		std::vector<MoveStatus> status;
+		run_batch(moves, status, journal_path);
+
+		return static_cast<size_t>(std::count_if(status.begin(), status.end(), [](MoveStatus s) { return s != MoveStatus::Failed; }));
+	}
+
+
+	size_t undo_moves(path_t const& journal_path)
+	{
+		auto entries = read_journal(journal_path);
+
+		// moves into one directory are undone newest first
+		auto groups = group_moves(entries.rbegin(), entries.rend(), [](UndoEntry const& entry) { return entry.file.parent_path(); });
+
+		std::atomic<size_t> n_moved = 0;
+
+		for_each_index(groups.size(), [&](size_t i)
+		{
+			for (auto const& entry : groups[i])
+			{
+				if (undo_entry(entry))
+				{
+					++n_moved;
+				}
+			}
+		});
+
+		std::error_code ec;
+		fs::remove(journal_path, ec);
+
+		return n_moved;
+	}
+
+
+	//======= MOVE QUEUE =================
+
+	// takes every pending move at once
+	static void run_moves(move_queue_t& queue)
+	{
+		std::vector<FileMove> batch;
+		std::vector<MoveStatus> batch_status;
+
+		std::unique_lock<std::mutex> lock(queue.mutex);
+
+		for (;;)
+		{
+			queue.cv.wait(lock, [&]() { return !queue.pending.empty() || !queue.running; });
+
+			if (queue.pending.empty())
+			{
+				return;
+			}
+
+			batch.clear();
+			std::swap(batch, queue.pending);
+
+			lock.unlock();
+
+			run_batch(batch, batch_status, queue.journal_path);
+
+			lock.lock();
+
+			for (size_t i = 0; i < batch.size(); ++i)
+			{
+				queue.status[batch[i].id] = batch_status[i];
+			}
+
+			queue.cv.notify_all();
+		}
+	}
+
+
+	move_queue_t::~move_queue_t()
+	{
+		// stop_moves was not called
+		assert(!worker.joinable());
+
+		if (worker.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				running = false;
+			}
+
+			cv.notify_all();
+			worker.detach();
+		}
+	}
+
+
+	void start_moves(move_queue_t& queue)
+	{
+		assert(!queue.worker.joinable());
+
+		queue.running = true;
+		queue.worker = std::thread(run_moves, std::ref(queue));
+	}
+
+
+	uint32_t move_files_async(move_queue_t& queue, std::vector<FileMove> const& moves)
+	{
+		uint32_t first_id = 0;
+
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+
+			assert(queue.running);
+
+			first_id = static_cast<uint32_t>(queue.status.size());
+
+			for (auto const& move : moves)
+			{
+				auto id = static_cast<uint32_t>(queue.status.size());
+				queue.status.push_back(MoveStatus::Pending);
+				queue.pending.push_back({ id, move.file, move.dst_dir, move.link });
+			}
+		}
+
+		queue.cv.notify_all();
+
+		return first_id;
+	}
+
+
+	static uint32_t queue_move(move_queue_t& queue, path_t const& file, path_t const& dst_dir, bool link)
+	{
+		uint32_t id = 0;
+
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+
+			assert(queue.running);
+
+			id = static_cast<uint32_t>(queue.status.size());
+			queue.status.push_back(MoveStatus::Pending);
+			queue.pending.push_back({ id, file, dst_dir, link });
+		}
+
+		queue.cv.notify_all();
+
+		return id;
+	}
+
+
+	uint32_t move_file_async(move_queue_t& queue, path_t const& file, path_t const& dst_dir)
+	{
+		return queue_move(queue, file, dst_dir, false);
+	}
+
+
+	uint32_t link_file_async(move_queue_t& queue, path_t const& file, path_t const& dst_dir)
+	{
+		return queue_move(queue, file, dst_dir, true);
+	}
+
+
+	MoveStatus move_status(move_queue_t& queue, uint32_t id)
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		assert(id < queue.status.size());
+
+		return queue.status[id];
+	}
+
+
+	void wait_for_moves(move_queue_t& queue)
+	{
+		std::unique_lock<std::mutex> lock(queue.mutex);
+
+		// moves are done in the order they were queued
+		queue.cv.wait(lock, [&]() { return queue.status.empty() || queue.status.back() != MoveStatus::Pending; });
+	}
+
+
+	void stop_moves(move_queue_t& queue)
+	{
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+
+			queue.running = false;
 		}
 
-		auto name = file.filename();
-		auto dst = dst_dir / name;
+		queue.cv.notify_all();
 
-		fs::rename(file, dst);
+		if (queue.worker.joinable())
+		{
+			queue.worker.join();
+		}
 	}
 
 
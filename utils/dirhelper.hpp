@@ -3,28 +3,206 @@
 #define DIRHELPER_NO_STR
 
 #include <vector>
+#include <string>
 #include <functional>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 #include <filesystem> // c++17
 namespace fs = std::filesystem;
 
 
-#ifndef DIRHELPER_NO_STR
 
-#include <string>
 
-#endif // !DIRHELPER_NO_STR
+namespace dirhelper
+{
+	using path_t = fs::path;
 
+	using char_t = path_t::value_type;
 
 
+	// one directory and the names of its files packed end to end in one buffer
+	// a path is only made when it is asked for
+	class packed_file_list_t
+	{
+	public:
 
-namespace dirhelper
-{
-	using path_t = fs::path;
+		path_t directory;
+
+		std::vector<char_t> names;     // null terminated, relative to directory
+		std::vector<uint32_t> offsets; // start of each name in names
+
+		size_t size() const { return offsets.size(); }
+
+		bool empty() const { return offsets.empty(); }
+
+		char_t const* name(size_t index) const { return names.data() + offsets[index]; }
+
+		path_t operator [] (size_t index) const { return directory / name(index); }
+
+		void push_back(char_t const* name, size_t length);
+
+		void push_back(path_t const& name) { push_back(name.c_str(), name.native().size()); }
+
+
+		class iterator
+		{
+		public:
+
+			packed_file_list_t const* list = 0;
+			size_t index = 0;
+
+			path_t operator * () const { return (*list)[index]; }
+
+			iterator& operator ++ () { ++index; return *this; }
+
+			bool operator == (iterator const& other) const { return index == other.index; }
 
-	using file_list_t = std::vector<path_t>;
+			bool operator != (iterator const& other) const { return index != other.index; }
+		};
+
+
+		iterator begin() const { return { this, 0 }; }
+
+		iterator end() const { return { this, size() }; }
+	};
+
+
+	using file_list_t = packed_file_list_t;
 	using file_func_t = std::function<void(path_t const&)>;
 
+
+	using listed_func_t = std::function<void()>;
+
+	using range_func_t = std::function<void(uint32_t begin, uint32_t end)>;
+
+	// runs func on parts of [begin, end) in parallel and returns when all of them are done
+	using parallel_for_t = std::function<void(uint32_t begin, uint32_t end, range_func_t const& func)>;
+
+
+	// what a stream has listed, in memory given by the caller
+	// plain data so that it can be copied with the rest of that memory
+	typedef struct file_listing_t
+	{
+		char_t* names;     // null terminated, relative to the stream directory
+		uint32_t* offsets; // start of each name in names
+		uint64_t* removed; // a bit for each file deleted or moved away, only known when watching
+		size_t names_capacity;
+		size_t max_files;  // offsets and the bits of removed
+
+		size_t n_listed;   // guarded by the stream mutex
+		bool complete;     // the directory has been listed, more files can follow when watching
+
+	} FileListing;
+
+
+	// the number of words of file_listing_t::removed
+	constexpr size_t removed_words(size_t max_files) { return (max_files + 63) / 64; }
+
+
+	// a directory listed on a producer thread while a consumer reads it
+	// names are written to memory given by the caller and never move
+	class file_stream_t
+	{
+	public:
+
+		path_t directory;
+
+		// set before starting the stream
+		file_listing_t* listing = 0;
+
+		listed_func_t on_listed; // called on the producer thread when more files can be read
+
+		// optional, the listing is saved here and reused until the directory changes
+		// must be outside of the directory
+		path_t cache_path;
+
+		// keep listing files written to or moved into the directory until stopped, Linux only
+		bool watch = false;
+
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::thread producer;
+
+		std::atomic<bool> stopping = false;
+
+		file_stream_t() = default;
+
+		file_stream_t(file_stream_t const&) = delete;
+
+		file_stream_t& operator = (file_stream_t const&) = delete;
+
+		// does not join, a join from a static destructor can deadlock under the dll loader lock
+		~file_stream_t();
+	};
+
+
+	enum class MoveStatus : uint32_t
+	{
+		Pending,
+		Moved,  // renamed
+		Copied, // copied to another filesystem and removed
+		Linked, // hard linked, the file stays
+		Cloned, // reflinked, the file stays
+		Failed,
+	};
+
+
+	typedef struct file_move_t
+	{
+		uint32_t id;
+		path_t file;
+		path_t dst_dir;
+		bool link; // the file stays and is also linked into dst_dir
+
+	} FileMove;
+
+
+	// files are moved in batches on a worker thread
+	class move_queue_t
+	{
+	public:
+
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::thread worker;
+
+		std::vector<FileMove> pending;  // guarded by mutex
+		std::vector<MoveStatus> status; // by move id, guarded by mutex
+		bool running = false;
+
+		// optional, each batch is appended here and synced before it is moved
+		// the moves that succeeded are appended and synced again after
+		path_t journal_path;
+
+		move_queue_t() = default;
+
+		move_queue_t(move_queue_t const&) = delete;
+
+		move_queue_t& operator = (move_queue_t const&) = delete;
+
+		// does not join, stop_moves before exit
+		~move_queue_t();
+	};
+
+
+	// dirhelper starts no threads for parallel work, it runs on the ones given here
+	// without it, directories are scanned and moved one at a time
+	void set_parallel_for(parallel_for_t const& func);
+
+
+	typedef struct scan_options_t
+	{
+		std::vector<std::string> extensions; // case insensitive, none matches any file with an extension
+
+		uint32_t max_depth = UINT32_MAX; // 0 scans only the top directory
+		size_t max_files = SIZE_MAX;     // files past this are not listed
+
+	} ScanOptions;
+
 	file_list_t get_all_files(path_t const& src_dir);
 
 	file_list_t get_files_of_type(path_t const& src_dir, const char* extension);
@@ -35,10 +213,68 @@ namespace dirhelper
 
 	path_t get_first_file_of_type(path_t const& src_dir, const char* extension);
 
+	// the subdirectories of each level are scanned in parallel on the threads given to set_parallel_for
+	// names are relative to src_dir, each level in turn and each directory sorted by name
+	file_list_t get_files_recursive(path_t const& src_dir, scan_options_t const& options);
+
+	// files are listed in batches that start small so the first file is seen right away
+	// listing ends early when the stream memory is full
+	void start_files_of_type(file_stream_t& stream, path_t const& src_dir, const char* extension);
+
+	// the number of files listed so far
+	size_t files_listed(file_stream_t& stream);
+
+	// blocks until the file at index is listed or the directory is done
+	// returns the number of files listed so far
+	size_t wait_for_file(file_stream_t& stream, size_t index);
+
+	// index must be less than a count returned by files_listed or wait_for_file
+	path_t get_file(file_stream_t const& stream, size_t index);
+
+	// a file that left the directory after it was listed, only known when watching
+	bool file_removed(file_stream_t& stream, size_t index);
+
+	// waits for the producer thread to finish
+	void stop_stream(file_stream_t& stream);
+
 	void process_files(file_list_t const& files, file_func_t const& func);
 
+	// files on another filesystem are copied then removed
 	void move_file(path_t const& file, path_t const& dst_dir);
 
+	void start_moves(move_queue_t& queue);
+
+	// returns right away with an id for move_status
+	uint32_t move_file_async(move_queue_t& queue, path_t const& file, path_t const& dst_dir);
+
+	// the file stays where it is, a hard link or a reflink is made in dst_dir without copying its data
+	uint32_t link_file_async(move_queue_t& queue, path_t const& file, path_t const& dst_dir);
+
+	// moves are queued together and run as one batch, like apply_moves
+	// returns the id of the first move, the others follow in order
+	uint32_t move_files_async(move_queue_t& queue, std::vector<FileMove> const& moves);
+
+	MoveStatus move_status(move_queue_t& queue, uint32_t id);
+
+	// blocks until every queued move is done
+	void wait_for_moves(move_queue_t& queue);
+
+	// finishes queued moves and waits for the worker thread
+	void stop_moves(move_queue_t& queue);
+
+	// moves grouped by destination directory, in parallel for each directory on the threads given to set_parallel_for
+	// all of them are journaled with one sync first if journal_path is not empty
+	// the moves that succeeded are journaled again with one sync for each directory
+	// returns the number of files moved
+	size_t apply_moves(std::vector<FileMove> const& moves, path_t const& journal_path);
+
+	// moves every file journaled as moved back, newest first and in parallel for each destination directory
+	// runs on the threads given to set_parallel_for
+	// a move cut short by a crash is undone if the file is at its destination and not at its source
+	// links are removed if they were made by the journaled move
+	// the journal is removed, returns the number of files moved back or unlinked
+	size_t undo_moves(path_t const& journal_path);
+
 
 #ifndef DIRHELPER_NO_STR
 
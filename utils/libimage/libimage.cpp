@@ -7,319 +7,1412 @@ Copyright (c) 2021 Adam Lafontaine
 #include "libimage.hpp"
 #include "stb_all.hpp"
 
+#include <cstring>
+#include <mutex>
+#include <vector>
+
 #ifndef LIBIMAGE_NO_MATH
 #include <numeric>
-#include <execution>
 #endif // !LIBIMAGE_NO_MATH
 
+#ifndef LIBIMAGE_NO_PARALLEL
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#endif // !LIBIMAGE_NO_PARALLEL
+
+#ifndef LIBIMAGE_NO_SIMD
+
+#if defined(__AVX2__)
+#define LIBIMAGE_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIBIMAGE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#define LIBIMAGE_SSSE3
+#include <tmmintrin.h>
+#endif
+
+#endif // !LIBIMAGE_NO_SIMD
+
 
 namespace libimage
 {
+	//======= IMAGE MEMORY =================
 
-#ifndef LIBIMAGE_NO_COLOR
+	// block sizes are rounded up to one of 4 sizes between each power of 2
+	constexpr u32 MIN_BLOCK_LOG2 = 6;
+	constexpr size_t MIN_BLOCK_BYTES = size_t(1) << MIN_BLOCK_LOG2;
+	constexpr u32 CLASSES_PER_DOUBLING = 4;
+	constexpr u32 N_SIZE_CLASSES = 1 + (64 - MIN_BLOCK_LOG2) * CLASSES_PER_DOUBLING;
 
-	void read_image_from_file(const char* img_path_src, image_t& image_dst)
-	{
-		int width = 0;
-		int height = 0;
-		int image_channels = 0;
-		int desired_channels = 4;
+	// most memory kept in free blocks, more is returned to the system
+	constexpr size_t MAX_KEPT_BYTES = size_t(512) * 1024 * 1024;
 
-		auto data = (rgba_pixel*)stbi_load(img_path_src, &width, &height, &image_channels, desired_channels);
+	constexpr u32 BLOCK_MAGIC = 0x696D6167;
 
-		assert(data);
-		assert(width);
-		assert(height);
 
-		image_dst.data = data;
-		image_dst.width = width;
-		image_dst.height = height;
-	}
+	// in front of the memory of each block
+	// aligned so that the memory after it is aligned
+	typedef struct alignas(16) block_header_t
+	{
+		block_header_t* next; // in the free list
+		u32 size_class;
+		u32 magic;
 
+	} BlockHeader;
 
-	void make_image(image_t& image_dst, u32 width, u32 height)
+
+	typedef struct block_pool_t
 	{
-		assert(width);
-		assert(height);
+		std::mutex mutex;
 
-		image_dst.width = width;
-		image_dst.height = height;
-		image_dst.data = (pixel_t*)malloc(sizeof(pixel_t) * width * height);
+		BlockHeader* free_blocks[N_SIZE_CLASSES] = {};
+		size_t kept_bytes = 0;
 
-		assert(image_dst.data);
-	}
+	} BlockPool;
 
 
-	view_t make_view(image_t const& img)
-	{
-		assert(img.width);
-		assert(img.height);
-		assert(img.data);
+	static BlockPool block_pool;
 
-		view_t view;
 
-		view.image_data = img.data;
-		view.image_width = img.width;
-		view.x_begin = 0;
-		view.y_begin = 0;
-		view.x_end = img.width;
-		view.y_end = img.height;
-		view.width = img.width;
-		view.height = img.height;
+	// blocks freed by a thread are reused by the same thread without locking the pool
+	// e.g. the decode and resize memory of each loader thread
+	constexpr u32 THREAD_CACHE_BLOCKS = 8;
+	constexpr size_t THREAD_CACHE_MAX_BYTES = size_t(128) * 1024 * 1024;
 
-		return view;
-	}
 
+	static void free_to_pool(BlockHeader* block);
 
-	view_t sub_view(image_t const& image, pixel_range_t const& range)
+
+	typedef struct thread_cache_t
 	{
-		assert(image.width);
-		assert(image.height);
-		assert(image.data);
+		BlockHeader* blocks[THREAD_CACHE_BLOCKS] = {};
+		u32 n_blocks = 0;
+		size_t n_bytes = 0;
 
-		view_t sub_view;
+		// blocks go to the pool when the thread ends
+		~thread_cache_t()
+		{
+			for (u32 i = 0; i < n_blocks; ++i)
+			{
+				free_to_pool(blocks[i]);
+			}
+		}
 
-		sub_view.image_data = image.data;
-		sub_view.image_width = image.width;
-		sub_view.x_begin = range.x_begin;
-		sub_view.y_begin = range.y_begin;
-		sub_view.x_end = range.x_end;
-		sub_view.y_end = range.y_end;
-		sub_view.width = range.x_end - range.x_begin;
-		sub_view.height = range.y_end - range.y_begin;
+	} ThreadCache;
 
-		assert(sub_view.width);
-		assert(sub_view.height);
 
-		return sub_view;
-	}
+	static thread_local ThreadCache thread_cache;
 
 
-	view_t sub_view(view_t const& view, pixel_range_t const& range)
+	static u32 floor_log2(size_t n)
 	{
-		assert(view.width);
-		assert(view.height);
-		assert(view.image_data);
+		u32 log2 = 0;
+		for (; n > 1; n >>= 1)
+		{
+			++log2;
+		}
 
-		/*assert(range.x_begin >= view.x_begin);
-		assert(range.x_end <= view.x_end);
-		assert(range.y_begin >= view.y_begin);
-		assert(range.y_end <= view.y_end);*/
+		return log2;
+	}
 
-		view_t sub_view;
 
-		sub_view.image_data = view.image_data;
-		sub_view.image_width = view.image_width;
-		sub_view.x_begin = view.x_begin + range.x_begin;
-		sub_view.y_begin = view.y_begin + range.y_begin;
-		sub_view.x_end = view.x_begin + range.x_end;
-		sub_view.y_end = view.y_begin + range.y_end;
-		sub_view.width = range.x_end - range.x_begin;
-		sub_view.height = range.y_end - range.y_begin;
+	static u32 to_size_class(size_t n_bytes)
+	{
+		if (n_bytes <= MIN_BLOCK_BYTES)
+		{
+			return 0;
+		}
 
-		assert(sub_view.width);
-		assert(sub_view.height);
+		// 2^k < n_bytes <= 2^(k + 1)
+		auto k = floor_log2(n_bytes - 1);
+		auto base = size_t(1) << k;
+		auto step = base / CLASSES_PER_DOUBLING;
 
-		return sub_view;
+		auto sub_class = static_cast<u32>((n_bytes - 1 - base) / step);
+
+		return 1 + (k - MIN_BLOCK_LOG2) * CLASSES_PER_DOUBLING + sub_class;
 	}
 
 
-	view_t row_view(image_t const& image, u32 y)
+	static size_t to_block_bytes(u32 size_class)
 	{
-		pixel_range_t range;
-		range.x_begin = 0;
-		range.x_end = image.width;
-		range.y_begin = y;
-		range.y_end = y + 1;
+		if (size_class == 0)
+		{
+			return MIN_BLOCK_BYTES;
+		}
 
-		return sub_view(image, range);
+		auto k = MIN_BLOCK_LOG2 + (size_class - 1) / CLASSES_PER_DOUBLING;
+		auto sub_class = (size_class - 1) % CLASSES_PER_DOUBLING;
+		auto base = size_t(1) << k;
+
+		return base + (sub_class + 1) * (base / CLASSES_PER_DOUBLING);
 	}
 
 
-	view_t row_view(view_t const& view, u32 y)
+	static BlockHeader* to_block(void* data)
 	{
-		pixel_range_t range;
-		range.x_begin = 0;
-		range.x_end = view.width;
-		range.y_begin = y;
-		range.y_end = y + 1;
+		auto block = (BlockHeader*)data - 1;
+		assert(block->magic == BLOCK_MAGIC);
 
-		return sub_view(view, range);
+		return block;
 	}
 
 
-	view_t column_view(image_t const& image, u32 x)
+	static BlockHeader* take_from_cache(u32 size_class)
 	{
-		pixel_range_t range;
-		range.x_begin = x;
-		range.x_end = x + 1;
-		range.y_begin = 0;
-		range.y_end = image.height;
-
-		return sub_view(image, range);
-	}
+		auto& cache = thread_cache;
 
+		for (u32 i = 0; i < cache.n_blocks; ++i)
+		{
+			auto block = cache.blocks[i];
+			if (block->size_class == size_class)
+			{
+				cache.blocks[i] = cache.blocks[--cache.n_blocks];
+				cache.n_bytes -= to_block_bytes(size_class);
 
-	view_t column_view(view_t const& view, u32 x)
-	{
-		pixel_range_t range;
-		range.x_begin = x;
-		range.x_end = x + 1;
-		range.y_begin = 0;
-		range.y_end = view.height;
+				return block;
+			}
+		}
 
-		return sub_view(view, range);
+		return 0;
 	}
 
 
-	view_t row_view(image_t const& image, u32 x_begin, u32 x_end, u32 y)
+	static BlockHeader* take_from_pool(u32 size_class)
 	{
-		pixel_range_t range;
-		range.x_begin = x_begin;
-		range.x_end = x_end;
-		range.y_begin = y;
-		range.y_end = y + 1;
+		auto& pool = block_pool;
 
-		return sub_view(image, range);
+		std::lock_guard<std::mutex> lock(pool.mutex);
+
+		auto block = pool.free_blocks[size_class];
+		if (block)
+		{
+			pool.free_blocks[size_class] = block->next;
+			pool.kept_bytes -= to_block_bytes(size_class);
+		}
+
+		return block;
 	}
 
 
-	view_t row_view(view_t const& view, u32 x_begin, u32 x_end, u32 y)
+	static bool free_to_cache(BlockHeader* block)
 	{
-		pixel_range_t range;
-		range.x_begin = x_begin;
-		range.x_end = x_end;
-		range.y_begin = y;
-		range.y_end = y + 1;
+		auto& cache = thread_cache;
+		auto block_bytes = to_block_bytes(block->size_class);
 
-		return sub_view(view, range);
+		if (cache.n_blocks == THREAD_CACHE_BLOCKS || cache.n_bytes + block_bytes > THREAD_CACHE_MAX_BYTES)
+		{
+			return false;
+		}
+
+		cache.blocks[cache.n_blocks++] = block;
+		cache.n_bytes += block_bytes;
+
+		return true;
 	}
 
 
-	view_t column_view(image_t const& image, u32 y_begin, u32 y_end, u32 x)
+	static void free_to_pool(BlockHeader* block)
 	{
-		pixel_range_t range;
-		range.x_begin = x;
-		range.x_end = x + 1;
-		range.y_begin = y_begin;
-		range.y_end = y_end;
+		auto block_bytes = to_block_bytes(block->size_class);
+		auto& pool = block_pool;
 
-		return sub_view(image, range);
-	}
+		{
+			std::lock_guard<std::mutex> lock(pool.mutex);
 
+			if (pool.kept_bytes + block_bytes <= MAX_KEPT_BYTES)
+			{
+				block->next = pool.free_blocks[block->size_class];
+				pool.free_blocks[block->size_class] = block;
+				pool.kept_bytes += block_bytes;
 
-	view_t column_view(view_t const& view, u32 y_begin, u32 y_end, u32 x)
-	{
-		pixel_range_t range;
-		range.x_begin = x;
-		range.x_end = x + 1;
-		range.y_begin = y_begin;
-		range.y_end = y_end;
+				return;
+			}
+		}
 
-		return sub_view(view, range);
+		free(block);
 	}
 
 
+	void* alloc_image_memory(size_t n_bytes)
+	{
+		auto size_class = to_size_class(n_bytes);
 
-#ifndef LIBIMAGE_NO_WRITE
+		BlockHeader* block = take_from_cache(size_class);
+		if (!block)
+		{
+			block = take_from_pool(size_class);
+		}
 
-	void write_image(image_t const& image_src, const char* file_path_dst)
-	{
-		assert(image_src.width);
-		assert(image_src.height);
-		assert(image_src.data);
+		if (!block)
+		{
+			block = (BlockHeader*)malloc(sizeof(BlockHeader) + to_block_bytes(size_class));
+			if (!block)
+			{
+				return 0;
+			}
 
-		int width = static_cast<int>(image_src.width);
-		int height = static_cast<int>(image_src.height);
-		int channels = static_cast<int>(RGBA_CHANNELS);
-		auto const data = image_src.data;
+			block->size_class = size_class;
+			block->magic = BLOCK_MAGIC;
+		}
 
-		int result = 0;
+		block->next = 0;
 
-		auto ext = fs::path(file_path_dst).extension();
+		return block + 1;
+	}
 
-		assert(ext == ".bmp" || ext == ".png");
 
-		if (ext == ".bmp" || ext == ".BMP")
+	void* realloc_image_memory(void* data, size_t n_bytes)
+	{
+		if (!data)
 		{
-			result = stbi_write_bmp(file_path_dst, width, height, channels, data);
+			return alloc_image_memory(n_bytes);
 		}
-		else if (ext == ".png" || ext == ".PNG")
-		{
-			int stride_in_bytes = width * channels;
 
-			result = stbi_write_png(file_path_dst, width, height, channels, data, stride_in_bytes);
+		auto block_bytes = to_block_bytes(to_block(data)->size_class);
+		if (n_bytes <= block_bytes)
+		{
+			return data;
 		}
-		else if (ext == ".jpg" || ext == ".jpeg" || ext == ".JPG" || ext == ".JPEG")
+
+		auto new_data = alloc_image_memory(n_bytes);
+		if (new_data)
 		{
-			// TODO: quality?
-			// stbi_write_jpg(char const *filename, int w, int h, int comp, const void *data, int quality);
+			memcpy(new_data, data, block_bytes);
+			free_image_memory(data);
 		}
 
-		assert(result);
+		return new_data;
 	}
 
 
-	static void make_image(view_t const& view, image_t& image_dst)
+	void free_image_memory(void* data)
 	{
-		make_image(image_dst, view.width, view.height);
+		if (!data)
+		{
+			return;
+		}
 
-		std::transform(view.begin(), view.end(), image_dst.begin(), [&](auto p) { return p; });
+		auto block = to_block(data);
+
+		if (!free_to_cache(block))
+		{
+			free_to_pool(block);
+		}
 	}
 
 
-	void write_view(view_t const& view_src, const char* file_path_dst)
+	void release_image_memory()
 	{
-		image_t image;
-		make_image(view_src, image);
+		auto& cache = thread_cache;
 
-		write_image(image, file_path_dst);
-	}
+		for (u32 i = 0; i < cache.n_blocks; ++i)
+		{
+			free(cache.blocks[i]);
+		}
 
-#endif // !LIBIMAGE_NO_WRITE
+		cache.n_blocks = 0;
+		cache.n_bytes = 0;
 
+		auto& pool = block_pool;
 
-#ifndef LIBIMAGE_NO_RESIZE
+		std::lock_guard<std::mutex> lock(pool.mutex);
 
-	void resize_image(image_t const& image_src, image_t& image_dst)
+		for (auto& head : pool.free_blocks)
+		{
+			while (head)
+			{
+				auto block = head;
+				head = block->next;
+				free(block);
+			}
+		}
+
+		pool.kept_bytes = 0;
+	}
+
+
+	// keeps memory that is already large enough
+	static void* realloc_pixels(void* data, size_t n_bytes)
 	{
-		assert(image_src.width);
-		assert(image_src.height);
-		assert(image_src.data);
-		assert(image_dst.width);
-		assert(image_dst.height);
+		if (data && n_bytes <= to_block_bytes(to_block(data)->size_class))
+		{
+			return data;
+		}
 
-		int channels = static_cast<int>(RGBA_CHANNELS);
+		free_image_memory(data);
 
-		int width_src = static_cast<int>(image_src.width);
-		int height_src = static_cast<int>(image_src.height);
-		int stride_bytes_src = width_src * channels;
+		return alloc_image_memory(n_bytes);
+	}
 
-		int width_dst = static_cast<int>(image_dst.width);
-		int height_dst = static_cast<int>(image_dst.height);
-		int stride_bytes_dst = width_dst * channels;
 
-		int result = 0;
+	//======= MEMORY ARENA =================
 
-		image_dst.data = (pixel_t*)malloc(sizeof(pixel_t) * image_dst.width * image_dst.height);
+	// pushed memory is aligned for simd and does not share cache lines with the memory before it
+	constexpr size_t ARENA_ALIGNMENT = 64;
 
-		result = stbir_resize_uint8(
-			(u8*)image_src.data, width_src, height_src, stride_bytes_src,
-			(u8*)image_dst.data, width_dst, height_dst, stride_bytes_dst,
-			channels);
 
-		assert(result);
+	arena_t make_arena(void* memory, size_t capacity)
+	{
+		arena_t arena = {};
+		arena.memory = (u8*)memory;
+		arena.capacity = capacity;
+		arena.size = 0;
+
+		return arena;
 	}
 
 
-	view_t make_resized_view(image_t const& img_src, image_t& img_dst)
+	void* push_bytes(arena_t& arena, size_t n_bytes)
 	{
-		resize_image(img_src, img_dst);
+		auto address = reinterpret_cast<size_t>(arena.memory + arena.size);
+		auto padding = (ARENA_ALIGNMENT - address % ARENA_ALIGNMENT) % ARENA_ALIGNMENT;
 
-		return make_view(img_dst);
+		if (arena.size + padding + n_bytes > arena.capacity)
+		{
+			return 0;
+		}
+
+		auto data = arena.memory + arena.size + padding;
+		arena.size += padding + n_bytes;
+
+		return data;
 	}
 
-#endif // !LIBIMAGE_NO_RESIZE
+
+	arena_t push_arena(arena_t& parent, size_t capacity)
+	{
+		auto memory = push_bytes(parent, capacity);
+
+		return make_arena(memory, memory ? capacity : 0);
+	}
+
+
+#ifndef LIBIMAGE_NO_WRITE
+
+	static void write_pixels(void const* data, u32 width, u32 height, int channels, const char* file_path_dst)
+	{
+		int w = static_cast<int>(width);
+		int h = static_cast<int>(height);
+
+		int result = 0;
+
+		auto ext = fs::path(file_path_dst).extension();
+
+		assert(ext == ".bmp" || ext == ".png");
+
+		if (ext == ".bmp" || ext == ".BMP")
+		{
+			result = stbi_write_bmp(file_path_dst, w, h, channels, data);
+		}
+		else if (ext == ".png" || ext == ".PNG")
+		{
+			int stride_in_bytes = w * channels;
+
+			result = stbi_write_png(file_path_dst, w, h, channels, data, stride_in_bytes);
+		}
+		else if (ext == ".jpg" || ext == ".jpeg" || ext == ".JPG" || ext == ".JPEG")
+		{
+			// TODO: quality?
+			// stbi_write_jpg(char const *filename, int w, int h, int comp, const void *data, int quality);
+		}
+
+		assert(result);
+	}
+
+#endif // !LIBIMAGE_NO_WRITE
+
+
+#ifndef LIBIMAGE_NO_PARALLEL
+
+	// tasks that do not fit in a worker's queue are run by the thread that queues them
+	constexpr u32 TASK_QUEUE_CAPACITY = 256;
+
+
+	typedef struct task_t
+	{
+		task_f func; // run_async
+
+		// parallel_for chunk, func is not used
+		range_f const* range = 0;
+		u32 begin = 0;
+		u32 end = 0;
+		std::atomic<u32>* remaining = 0;
+
+	} Task;
+
+
+	// fixed ring of tasks so that queueing does not allocate
+	typedef struct task_queue_t
+	{
+		std::mutex mutex;
+		std::array<Task, TASK_QUEUE_CAPACITY> tasks;
+
+		u32 front = 0;
+		u32 count = 0;
+
+	} TaskQueue;
+
+
+	typedef struct task_pool_t
+	{
+		// one queue per worker, other workers steal from the front
+		std::vector<std::unique_ptr<TaskQueue>> queues;
+		std::vector<std::thread> workers;
+
+		std::mutex sleep_mutex;
+		std::condition_variable sleep_cv;
+
+		std::atomic<u32> n_queued = 0;  // changed with the lock of the queue the task is in
+		std::atomic<u32> n_callers = 0; // threads outside the pool using the queues
+		std::atomic<u32> next_queue = 0;
+
+		std::mutex start_mutex;
+		std::atomic<bool> running = false;
+		u32 max_workers = 0;
+
+		// does not join, a join from a static destructor can deadlock under the dll loader lock
+		~task_pool_t();
+
+	} TaskPool;
+
+
+	static TaskPool task_pool;
+
+	// index of the worker's own queue, -1 for threads outside the pool
+	static thread_local int worker_id = -1;
+
+	// nested enter_pool calls of a thread outside the pool
+	static thread_local u32 caller_depth = 0;
+
+
+	static void run_task(Task& task)
+	{
+		if (task.range)
+		{
+			(*task.range)(task.begin, task.end);
+			--*task.remaining;
+		}
+		else
+		{
+			task.func();
+		}
+	}
+
+
+	static bool pop_task(TaskPool& pool, TaskQueue& queue, Task& task, bool from_back)
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		if (!queue.count)
+		{
+			return false;
+		}
+
+		if (from_back)
+		{
+			task = std::move(queue.tasks[(queue.front + queue.count - 1) % TASK_QUEUE_CAPACITY]);
+		}
+		else
+		{
+			task = std::move(queue.tasks[queue.front]);
+			queue.front = (queue.front + 1) % TASK_QUEUE_CAPACITY;
+		}
+
+		--queue.count;
+		--pool.n_queued;
+
+		return true;
+	}
+
+
+	// runs the calling worker's newest task or steals the oldest task of another worker
+	static bool try_run_task(TaskPool& pool)
+	{
+		auto n_queues = static_cast<int>(pool.queues.size());
+		Task task;
+
+		bool found = worker_id >= 0 && pop_task(pool, *pool.queues[worker_id], task, true);
+
+		int start = worker_id >= 0 ? worker_id + 1 : 0;
+		for (int i = 0; !found && i < n_queues; ++i)
+		{
+			found = pop_task(pool, *pool.queues[(start + i) % n_queues], task, false);
+		}
+
+		if (!found)
+		{
+			return false;
+		}
+
+		run_task(task);
+
+		return true;
+	}
+
+
+	static void worker_proc(TaskPool& pool, int id)
+	{
+		worker_id = id;
+
+		for (;;)
+		{
+			if (try_run_task(pool))
+			{
+				continue;
+			}
+
+			// queued tasks are finished before the worker stops
+			if (!pool.running)
+			{
+				// threads outside the pool can still queue tasks
+				if (pool.n_callers > 0)
+				{
+					std::this_thread::yield();
+					continue;
+				}
+
+				if (try_run_task(pool))
+				{
+					continue;
+				}
+
+				break;
+			}
+
+			std::unique_lock<std::mutex> lock(pool.sleep_mutex);
+			pool.sleep_cv.wait(lock, [&]() { return !pool.running || pool.n_queued > 0; });
+		}
+	}
+
+
+	// call with start_mutex locked
+	static void launch_workers(TaskPool& pool)
+	{
+		u32 n_workers = std::thread::hardware_concurrency();
+		if (pool.max_workers && pool.max_workers < n_workers)
+		{
+			n_workers = pool.max_workers;
+		}
+
+		if (!n_workers)
+		{
+			n_workers = 1;
+		}
+
+		pool.queues.clear();
+		for (u32 i = 0; i < n_workers; ++i)
+		{
+			pool.queues.push_back(std::make_unique<TaskQueue>());
+		}
+
+		pool.n_queued = 0;
+		pool.running = true;
+
+		for (u32 i = 0; i < n_workers; ++i)
+		{
+			pool.workers.push_back(std::thread(worker_proc, std::ref(pool), static_cast<int>(i)));
+		}
+	}
+
+
+	// every queued task is run before the workers are joined
+	// call with start_mutex locked
+	static void drain_workers(TaskPool& pool)
+	{
+		{
+			std::lock_guard<std::mutex> sleep_lock(pool.sleep_mutex);
+			pool.running = false;
+		}
+
+		pool.sleep_cv.notify_all();
+
+		for (auto& worker : pool.workers)
+		{
+			worker.join();
+		}
+
+		assert(pool.n_queued == 0);
+
+		pool.workers.clear();
+		pool.queues.clear();
+	}
+
+
+	static void start_workers(TaskPool& pool)
+	{
+		if (pool.running)
+		{
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(pool.start_mutex);
+
+		if (!pool.running)
+		{
+			launch_workers(pool);
+		}
+	}
+
+
+	static void join_workers(TaskPool& pool)
+	{
+		std::lock_guard<std::mutex> lock(pool.start_mutex);
+
+		drain_workers(pool);
+	}
+
+
+	// threads outside the pool call this before using the queues, the workers are started if needed
+	// workers, and callers already in the pool, use the queues until they are done
+	static void enter_pool(TaskPool& pool)
+	{
+		if (worker_id >= 0 || caller_depth++ > 0)
+		{
+			return;
+		}
+
+		for (;;)
+		{
+			++pool.n_callers;
+
+			if (pool.running)
+			{
+				return;
+			}
+
+			--pool.n_callers;
+			start_workers(pool);
+		}
+	}
+
+
+	static void leave_pool(TaskPool& pool)
+	{
+		if (worker_id < 0 && --caller_depth == 0)
+		{
+			--pool.n_callers;
+		}
+	}
+
+
+	task_pool_t::~task_pool_t()
+	{
+		// stop_workers was not called
+		assert(workers.empty());
+
+		for (auto& worker : workers)
+		{
+			worker.detach();
+		}
+	}
+
+
+	static void push_task(TaskPool& pool, Task&& task)
+	{
+		enter_pool(pool);
+
+		auto n_queues = static_cast<u32>(pool.queues.size());
+		auto id = worker_id >= 0 ? static_cast<u32>(worker_id) : pool.next_queue++ % n_queues;
+
+		bool is_queued = false;
+
+		{
+			auto& queue = *pool.queues[id];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+
+			is_queued = queue.count < TASK_QUEUE_CAPACITY;
+			if (is_queued)
+			{
+				queue.tasks[(queue.front + queue.count) % TASK_QUEUE_CAPACITY] = std::move(task);
+				++queue.count;
+				++pool.n_queued;
+			}
+		}
+
+		leave_pool(pool);
+
+		if (!is_queued)
+		{
+			run_task(task);
+			return;
+		}
+
+		// a worker that found no tasks holds the sleep lock until it waits
+		{
+			std::lock_guard<std::mutex> lock(pool.sleep_mutex);
+		}
+
+		pool.sleep_cv.notify_one();
+	}
+
+
+	void set_max_workers(u32 max_workers)
+	{
+		auto& pool = task_pool;
+
+		std::lock_guard<std::mutex> lock(pool.start_mutex);
+
+		bool restart = pool.running;
+
+		if (restart)
+		{
+			drain_workers(pool);
+		}
+
+		pool.max_workers = max_workers;
+
+		if (restart)
+		{
+			launch_workers(pool);
+		}
+	}
+
+
+	u32 worker_count()
+	{
+		auto& pool = task_pool;
+		enter_pool(pool);
+
+		auto n_workers = static_cast<u32>(pool.queues.size());
+
+		leave_pool(pool);
+
+		return n_workers;
+	}
+
+
+	void run_async(task_f const& task)
+	{
+		Task async;
+		async.func = task;
+
+		push_task(task_pool, std::move(async));
+	}
+
+
+	void parallel_for(u32 begin, u32 end, range_f const& func, u32 grain_size)
+	{
+		if (end <= begin)
+		{
+			return;
+		}
+
+		auto& pool = task_pool;
+		enter_pool(pool);
+
+		u32 const size = end - begin;
+
+		if (!grain_size)
+		{
+			// a few chunks per worker for load balancing
+			u32 n_chunks = 4 * static_cast<u32>(pool.queues.size());
+			grain_size = (size + n_chunks - 1) / n_chunks;
+		}
+
+		u32 const n_chunks = (size + grain_size - 1) / grain_size;
+
+		if (n_chunks < 2)
+		{
+			leave_pool(pool);
+			func(begin, end);
+			return;
+		}
+
+		std::atomic<u32> remaining = n_chunks - 1;
+
+		for (u32 chunk = 1; chunk < n_chunks; ++chunk)
+		{
+			u32 chunk_begin = begin + chunk * grain_size;
+			u32 chunk_end = chunk == n_chunks - 1 ? end : chunk_begin + grain_size;
+
+			Task chunk_task;
+			chunk_task.range = &func;
+			chunk_task.begin = chunk_begin;
+			chunk_task.end = chunk_end;
+			chunk_task.remaining = &remaining;
+
+			push_task(pool, std::move(chunk_task));
+		}
+
+		func(begin, begin + grain_size);
+
+		// help with queued work until all chunks are done
+		while (remaining > 0)
+		{
+			if (!try_run_task(pool))
+			{
+				std::this_thread::yield();
+			}
+		}
+
+		leave_pool(pool);
+	}
+
+
+	void stop_workers()
+	{
+		join_workers(task_pool);
+	}
+
+#else
+
+	void set_max_workers(u32 max_workers)
+	{
+
+	}
+
+
+	u32 worker_count()
+	{
+		return 0;
+	}
+
+
+	void run_async(task_f const& task)
+	{
+		task();
+	}
+
+
+	void parallel_for(u32 begin, u32 end, range_f const& func, u32 grain_size)
+	{
+		if (begin < end)
+		{
+			func(begin, end);
+		}
+	}
+
+
+	void stop_workers()
+	{
+
+	}
+
+#endif // !LIBIMAGE_NO_PARALLEL
+
+
+#ifndef LIBIMAGE_NO_RESIZE
+
+	// output rows are split into bands that are resized in parallel
+	// rows_func(u32 y_begin, u32 y_end) is called on each band after it is resized
+	template <class ROWS_F>
+	static int resize_uint8(u8 const* src, int width_src, int height_src, u8* dst, int width_dst, int height_dst, int stride_bytes_dst, int channels, ROWS_F const& rows_func)
+	{
+		int stride_bytes_src = width_src * channels;
+
+#ifdef LIBIMAGE_NO_PARALLEL
+
+		auto result = stbir_resize_uint8(
+			src, width_src, height_src, stride_bytes_src,
+			dst, width_dst, height_dst, stride_bytes_dst,
+			channels);
+
+		rows_func(0u, static_cast<u32>(height_dst));
+
+		return result;
+
+#else
+
+		float x_scale = (float)width_dst / width_src;
+		float y_scale = (float)height_dst / height_src;
+
+		std::atomic<int> result = 1;
+
+		auto const resize_rows = [&](u32 y_begin, u32 y_end)
+		{
+			auto dst_rows = dst + (size_t)y_begin * stride_bytes_dst;
+			int height_rows = static_cast<int>(y_end - y_begin);
+
+			// y_begin shifts the output rows within the full size output
+			auto rows_result = stbir_resize_subpixel(
+				src, width_src, height_src, stride_bytes_src,
+				dst_rows, width_dst, height_rows, stride_bytes_dst,
+				STBIR_TYPE_UINT8, channels, -1, 0,
+				STBIR_EDGE_CLAMP, STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT, STBIR_FILTER_DEFAULT, STBIR_COLORSPACE_LINEAR, NULL,
+				x_scale, y_scale, 0.0f, (float)y_begin);
+
+			if (!rows_result)
+			{
+				result = 0;
+			}
+
+			// band is still in cache
+			rows_func(y_begin, y_end);
+		};
+
+		// each band recalculates the filters and rereads rows at its edges
+		// so use one band per worker
+		auto n_bands = worker_count();
+		auto band_rows = (static_cast<u32>(height_dst) + n_bands - 1) / n_bands;
+
+		parallel_for(0u, static_cast<u32>(height_dst), resize_rows, band_rows);
+
+		return result;
+
+#endif // LIBIMAGE_NO_PARALLEL
+	}
+
+
+	static int resize_uint8(u8 const* src, int width_src, int height_src, u8* dst, int width_dst, int height_dst, int channels)
+	{
+		return resize_uint8(src, width_src, height_src, dst, width_dst, height_dst, width_dst * channels, channels, [](u32, u32) {});
+	}
+
+#endif // !LIBIMAGE_NO_RESIZE
+
+
+#ifndef LIBIMAGE_NO_COLOR
+
+	void read_image_from_file(const char* img_path_src, image_t& image_dst)
+	{
+		int width = 0;
+		int height = 0;
+		int image_channels = 0;
+		int desired_channels = 4;
+
+		image_dst.clear();
+
+		auto data = (rgba_pixel*)stbi_load(img_path_src, &width, &height, &image_channels, desired_channels);
+
+		assert(data);
+		assert(width);
+		assert(height);
+
+		image_dst.data = data;
+		image_dst.width = width;
+		image_dst.height = height;
+	}
+
+
+	void make_image(image_t& image_dst, u32 width, u32 height)
+	{
+		assert(width);
+		assert(height);
+
+		image_dst.width = width;
+		image_dst.height = height;
+		image_dst.data = (pixel_t*)realloc_pixels(image_dst.data, sizeof(pixel_t) * width * height);
+
+		assert(image_dst.data);
+	}
+
+
+	view_t make_view(image_t const& img)
+	{
+		assert(img.width);
+		assert(img.height);
+		assert(img.data);
+
+		view_t view;
+
+		view.image_data = img.data;
+		view.image_width = img.width;
+		view.x_begin = 0;
+		view.y_begin = 0;
+		view.x_end = img.width;
+		view.y_end = img.height;
+		view.width = img.width;
+		view.height = img.height;
+
+		return view;
+	}
+
+
+	view_t push_view(arena_t& arena, u32 width, u32 height)
+	{
+		assert(width);
+		assert(height);
+
+		view_t view;
+
+		auto data = push_array<pixel_t>(arena, static_cast<size_t>(width) * height);
+		if (!data)
+		{
+			return view;
+		}
+
+		view.image_data = data;
+		view.image_width = width;
+		view.x_begin = 0;
+		view.y_begin = 0;
+		view.x_end = width;
+		view.y_end = height;
+		view.width = width;
+		view.height = height;
+
+		return view;
+	}
+
+
+	view_t sub_view(image_t const& image, pixel_range_t const& range)
+	{
+		assert(image.width);
+		assert(image.height);
+		assert(image.data);
+
+		view_t sub_view;
+
+		sub_view.image_data = image.data;
+		sub_view.image_width = image.width;
+		sub_view.x_begin = range.x_begin;
+		sub_view.y_begin = range.y_begin;
+		sub_view.x_end = range.x_end;
+		sub_view.y_end = range.y_end;
+		sub_view.width = range.x_end - range.x_begin;
+		sub_view.height = range.y_end - range.y_begin;
+
+		assert(sub_view.width);
+		assert(sub_view.height);
+
+		return sub_view;
+	}
+
+
+	view_t sub_view(view_t const& view, pixel_range_t const& range)
+	{
+		assert(view.width);
+		assert(view.height);
+		assert(view.image_data);
+
+		/*assert(range.x_begin >= view.x_begin);
+		assert(range.x_end <= view.x_end);
+		assert(range.y_begin >= view.y_begin);
+		assert(range.y_end <= view.y_end);*/
+
+		view_t sub_view;
+
+		sub_view.image_data = view.image_data;
+		sub_view.image_width = view.image_width;
+		sub_view.x_begin = view.x_begin + range.x_begin;
+		sub_view.y_begin = view.y_begin + range.y_begin;
+		sub_view.x_end = view.x_begin + range.x_end;
+		sub_view.y_end = view.y_begin + range.y_end;
+		sub_view.width = range.x_end - range.x_begin;
+		sub_view.height = range.y_end - range.y_begin;
+
+		assert(sub_view.width);
+		assert(sub_view.height);
+
+		return sub_view;
+	}
+
+
+	view_t row_view(image_t const& image, u32 y)
+	{
+		pixel_range_t range;
+		range.x_begin = 0;
+		range.x_end = image.width;
+		range.y_begin = y;
+		range.y_end = y + 1;
+
+		return sub_view(image, range);
+	}
+
+
+	view_t row_view(view_t const& view, u32 y)
+	{
+		pixel_range_t range;
+		range.x_begin = 0;
+		range.x_end = view.width;
+		range.y_begin = y;
+		range.y_end = y + 1;
+
+		return sub_view(view, range);
+	}
+
+
+	view_t column_view(image_t const& image, u32 x)
+	{
+		pixel_range_t range;
+		range.x_begin = x;
+		range.x_end = x + 1;
+		range.y_begin = 0;
+		range.y_end = image.height;
+
+		return sub_view(image, range);
+	}
+
+
+	view_t column_view(view_t const& view, u32 x)
+	{
+		pixel_range_t range;
+		range.x_begin = x;
+		range.x_end = x + 1;
+		range.y_begin = 0;
+		range.y_end = view.height;
+
+		return sub_view(view, range);
+	}
+
+
+	view_t row_view(image_t const& image, u32 x_begin, u32 x_end, u32 y)
+	{
+		pixel_range_t range;
+		range.x_begin = x_begin;
+		range.x_end = x_end;
+		range.y_begin = y;
+		range.y_end = y + 1;
+
+		return sub_view(image, range);
+	}
+
+
+	view_t row_view(view_t const& view, u32 x_begin, u32 x_end, u32 y)
+	{
+		pixel_range_t range;
+		range.x_begin = x_begin;
+		range.x_end = x_end;
+		range.y_begin = y;
+		range.y_end = y + 1;
+
+		return sub_view(view, range);
+	}
+
+
+	view_t column_view(image_t const& image, u32 y_begin, u32 y_end, u32 x)
+	{
+		pixel_range_t range;
+		range.x_begin = x;
+		range.x_end = x + 1;
+		range.y_begin = y_begin;
+		range.y_end = y_end;
+
+		return sub_view(image, range);
+	}
+
+
+	view_t column_view(view_t const& view, u32 y_begin, u32 y_end, u32 x)
+	{
+		pixel_range_t range;
+		range.x_begin = x;
+		range.x_end = x + 1;
+		range.y_begin = y_begin;
+		range.y_end = y_end;
+
+		return sub_view(view, range);
+	}
+
+
+
+#ifndef LIBIMAGE_NO_WRITE
+
+	void write_image(image_t const& image_src, const char* file_path_dst)
+	{
+		assert(image_src.width);
+		assert(image_src.height);
+		assert(image_src.data);
+
+		write_pixels(image_src.data, image_src.width, image_src.height, static_cast<int>(RGBA_CHANNELS), file_path_dst);
+	}
+
+
+	static void make_image(view_t const& view, image_t& image_dst)
+	{
+		make_image(image_dst, view.width, view.height);
+
+		auto dst = image_dst.data;
+
+		for_each_row(view, [&](pixel_t* row, u32 width)
+		{
+			std::copy(row, row + width, dst);
+			dst += width;
+		});
+	}
+
+
+	void write_view(view_t const& view_src, const char* file_path_dst)
+	{
+		image_t image;
+		make_image(view_src, image);
+
+		write_image(image, file_path_dst);
+	}
+
+
+	void write_view(view_t const& view_src, const char* file_path_dst, arena_t& scratch)
+	{
+		auto data = push_array<pixel_t>(scratch, static_cast<size_t>(view_src.width) * view_src.height);
+		assert(data);
+
+		auto dst = data;
+
+		for_each_row(view_src, [&](pixel_t* row, u32 width)
+		{
+			std::copy(row, row + width, dst);
+			dst += width;
+		});
+
+		write_pixels(data, view_src.width, view_src.height, static_cast<int>(RGBA_CHANNELS), file_path_dst);
+	}
+
+#endif // !LIBIMAGE_NO_WRITE
+
+
+#ifndef LIBIMAGE_NO_RESIZE
+
+	void resize_image(image_t const& image_src, image_t& image_dst)
+	{
+		assert(image_src.width);
+		assert(image_src.height);
+		assert(image_src.data);
+		assert(image_dst.width);
+		assert(image_dst.height);
+
+		int channels = static_cast<int>(RGBA_CHANNELS);
+
+		int width_src = static_cast<int>(image_src.width);
+		int height_src = static_cast<int>(image_src.height);
+
+		int width_dst = static_cast<int>(image_dst.width);
+		int height_dst = static_cast<int>(image_dst.height);
+
+		int result = 0;
+
+		image_dst.data = (pixel_t*)realloc_pixels(image_dst.data, sizeof(pixel_t) * image_dst.width * image_dst.height);
+
+		result = resize_uint8(
+			(u8*)image_src.data, width_src, height_src,
+			(u8*)image_dst.data, width_dst, height_dst,
+			channels);
+
+		assert(result);
+	}
+
+
+	// rewrites rgba pixels in place in format F
+	template <PixelFormat F>
+	static void convert_pixels(pixel_t* pixels, size_t n_pixels)
+	{
+		// rgba pixels are already in format
+		if constexpr (F == PixelFormat::RGBA)
+		{
+			return;
+		}
+		else
+		{
+			static_assert(F == PixelFormat::BGRA, "unsupported pixel format");
+
+			size_t i = 0;
+
+#if defined(LIBIMAGE_AVX2)
+
+			// byte indices within each 128 bit lane
+			auto const swap_red_blue = _mm256_setr_epi8(
+				2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+				2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+			for (; i + 8 <= n_pixels; i += 8)
+			{
+				auto px = _mm256_loadu_si256((__m256i const*)(pixels + i));
+				_mm256_storeu_si256((__m256i*)(pixels + i), _mm256_shuffle_epi8(px, swap_red_blue));
+			}
+
+#elif defined(LIBIMAGE_SSSE3)
+
+			auto const swap_red_blue = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+			for (; i + 4 <= n_pixels; i += 4)
+			{
+				auto px = _mm_loadu_si128((__m128i const*)(pixels + i));
+				_mm_storeu_si128((__m128i*)(pixels + i), _mm_shuffle_epi8(px, swap_red_blue));
+			}
+
+#elif defined(LIBIMAGE_SSE2)
+
+			auto const byte_mask = _mm_set1_epi32(0xFF);
+			auto const green_alpha_mask = _mm_set1_epi32((int)0xFF00FF00);
+
+			for (; i + 4 <= n_pixels; i += 4)
+			{
+				auto px = _mm_loadu_si128((__m128i const*)(pixels + i));
+
+				auto red = _mm_slli_epi32(_mm_and_si128(px, byte_mask), 16);
+				auto blue = _mm_and_si128(_mm_srli_epi32(px, 16), byte_mask);
+				auto green_alpha = _mm_and_si128(px, green_alpha_mask);
+
+				_mm_storeu_si128((__m128i*)(pixels + i), _mm_or_si128(_mm_or_si128(red, blue), green_alpha));
+			}
+
+#endif
+
+			for (; i < n_pixels; ++i)
+			{
+				pixels[i] = to_format<F>(pixels[i]);
+			}
+		}
+	}
+
+
+	template <PixelFormat F>
+	void resize_to_format(image_t const& image_src, view_t const& view_dst)
+	{
+		assert(image_src.width);
+		assert(image_src.height);
+		assert(image_src.data);
+		assert(view_dst.width);
+		assert(view_dst.height);
+		assert(view_dst.image_data);
+
+		int channels = static_cast<int>(RGBA_CHANNELS);
+
+		int width_src = static_cast<int>(image_src.width);
+		int height_src = static_cast<int>(image_src.height);
+
+		int width_dst = static_cast<int>(view_dst.width);
+		int height_dst = static_cast<int>(view_dst.height);
+		int stride_bytes_dst = static_cast<int>(view_dst.image_width * sizeof(pixel_t));
+
+		auto const convert_rows = [&](u32 y_begin, u32 y_end)
+		{
+			if (view_dst.width == view_dst.image_width)
+			{
+				auto n_pixels = static_cast<size_t>(y_end - y_begin) * view_dst.width;
+				convert_pixels<F>(view_dst.row_begin(y_begin), n_pixels);
+				return;
+			}
+
+			for (u32 y = y_begin; y < y_end; ++y)
+			{
+				convert_pixels<F>(view_dst.row_begin(y), view_dst.width);
+			}
+		};
+
+		int result = resize_uint8(
+			(u8*)image_src.data, width_src, height_src,
+			(u8*)view_dst.row_begin(0), width_dst, height_dst, stride_bytes_dst,
+			channels, convert_rows);
+
+		assert(result);
+	}
+
+
+	template <PixelFormat F>
+	void resize_to_format(image_t const& image_src, image_t& image_dst)
+	{
+		resize_to_format<F>(image_src, make_view(image_dst));
+	}
+
+	template void resize_to_format<PixelFormat::RGBA>(image_t const&, view_t const&);
+	template void resize_to_format<PixelFormat::BGRA>(image_t const&, view_t const&);
+	template void resize_to_format<PixelFormat::RGBA>(image_t const&, image_t&);
+	template void resize_to_format<PixelFormat::BGRA>(image_t const&, image_t&);
+
+
+	view_t make_resized_view(image_t const& img_src, image_t& img_dst)
+	{
+		resize_image(img_src, img_dst);
+
+		return make_view(img_dst);
+	}
+
+#endif // !LIBIMAGE_NO_RESIZE
 
 #endif // !LIBIMAGE_NO_COLOR
 	
@@ -331,344 +1424,971 @@ namespace libimage
 		int image_channels = 0;
 		int desired_channels = 1;
 
-		auto data = (gray::pixel_t*)stbi_load(file_path_src, &width, &height, &image_channels, desired_channels);
+		image_dst.clear();
+
+		auto data = (gray::pixel_t*)stbi_load(file_path_src, &width, &height, &image_channels, desired_channels);
+
+		assert(data);
+		assert(width);
+		assert(height);
+
+		image_dst.data = data;
+		image_dst.width = width;
+		image_dst.height = height;
+	}
+
+
+	void make_image(gray::image_t& image_dst, u32 width, u32 height)
+	{
+		assert(width);
+		assert(height);
+
+		image_dst.width = width;
+		image_dst.height = height;
+		image_dst.data = (gray::pixel_t*)realloc_pixels(image_dst.data, sizeof(gray::pixel_t) * width * height);
+
+		assert(image_dst.data);
+	}
+
+
+	gray::view_t make_view(gray::image_t const& img)
+	{
+		assert(img.width);
+		assert(img.height);
+		assert(img.data);
+
+		gray::view_t view;
+
+		view.image_data = img.data;
+		view.image_width = img.width;
+		view.x_begin = 0;
+		view.y_begin = 0;
+		view.x_end = img.width;
+		view.y_end = img.height;
+		view.width = img.width;
+		view.height = img.height;
+
+		return view;
+	}
+
+
+	gray::view_t sub_view(gray::image_t const& image, pixel_range_t const& range)
+	{
+		assert(image.width);
+		assert(image.height);
+		assert(image.data);
+
+		gray::view_t sub_view;
+
+		sub_view.image_data = image.data;
+		sub_view.image_width = image.width;
+		sub_view.x_begin = range.x_begin;
+		sub_view.y_begin = range.y_begin;
+		sub_view.x_end = range.x_end;
+		sub_view.y_end = range.y_end;
+		sub_view.width = range.x_end - range.x_begin;
+		sub_view.height = range.y_end - range.y_begin;
+
+		assert(sub_view.width);
+		assert(sub_view.height);
+
+		return sub_view;
+	}
+
+
+	gray::view_t sub_view(gray::view_t const& view, pixel_range_t const& range)
+	{
+		assert(view.width);
+		assert(view.height);
+		assert(view.image_data);
+
+		assert(range.x_begin >= view.x_begin);
+		assert(range.x_end <= view.x_end);
+		assert(range.y_begin >= view.y_begin);
+		assert(range.y_end <= view.y_end);
+
+		gray::view_t sub_view;
+
+		sub_view.image_data = view.image_data;
+		sub_view.image_width = view.image_width;
+		sub_view.x_begin = view.x_begin + range.x_begin;
+		sub_view.y_begin = view.y_begin + range.y_begin;
+		sub_view.x_end = view.x_begin + range.x_end;
+		sub_view.y_end = view.y_begin + range.y_end;
+		sub_view.width = range.x_end - range.x_begin;
+		sub_view.height = range.y_end - range.y_begin;
+
+		assert(sub_view.width);
+		assert(sub_view.height);
+
+		return sub_view;
+	}
+
+
+	gray::view_t row_view(gray::image_t const& image, u32 y)
+	{
+		pixel_range_t range;
+		range.x_begin = 0;
+		range.x_end = image.width;
+		range.y_begin = y;
+		range.y_end = y + 1;
+
+		return sub_view(image, range);
+	}
+
+
+	gray::view_t row_view(gray::view_t const& view, u32 y)
+	{
+		pixel_range_t range;
+		range.x_begin = 0;
+		range.x_end = view.width;
+		range.y_begin = y;
+		range.y_end = y + 1;
+
+		return sub_view(view, range);
+	}
+
+
+	gray::view_t column_view(gray::image_t const& image, u32 x)
+	{
+		pixel_range_t range;
+		range.x_begin = x;
+		range.x_end = x + 1;
+		range.y_begin = 0;
+		range.y_end = image.height;
+
+		return sub_view(image, range);
+	}
+
+
+	gray::view_t column_view(gray::view_t const& view, u32 x)
+	{
+		pixel_range_t range;
+		range.x_begin = x;
+		range.x_end = x + 1;
+		range.y_begin = 0;
+		range.y_end = view.height;
+
+		return sub_view(view, range);
+	}
+
+
+	gray::view_t row_view(gray::image_t const& image, u32 x_begin, u32 x_end, u32 y)
+	{
+		pixel_range_t range;
+		range.x_begin = x_begin;
+		range.x_end = x_end;
+		range.y_begin = y;
+		range.y_end = y + 1;
+
+		return sub_view(image, range);
+	}
+
+
+	gray::view_t row_view(gray::view_t const& view, u32 x_begin, u32 x_end, u32 y)
+	{
+		pixel_range_t range;
+		range.x_begin = x_begin;
+		range.x_end = x_end;
+		range.y_begin = y;
+		range.y_end = y + 1;
+
+		return sub_view(view, range);
+	}
+
+
+	gray::view_t column_view(gray::image_t const& image, u32 y_begin, u32 y_end, u32 x)
+	{
+		pixel_range_t range;
+		range.x_begin = x;
+		range.x_end = x + 1;
+		range.y_begin = y_begin;
+		range.y_end = y_end;
+
+		return sub_view(image, range);
+	}
+
+
+	gray::view_t column_view(gray::view_t const& view, u32 y_begin, u32 y_end, u32 x)
+	{
+		pixel_range_t range;
+		range.x_begin = x;
+		range.x_end = x + 1;
+		range.y_begin = y_begin;
+		range.y_end = y_end;
+
+		return sub_view(view, range);
+	}
+
+
+#ifndef LIBIMAGE_NO_WRITE
+
+	void write_image(gray::image_t const& image_src, const char* file_path_dst)
+	{
+		assert(image_src.width);
+		assert(image_src.height);
+		assert(image_src.data);
+
+		write_pixels(image_src.data, image_src.width, image_src.height, 1, file_path_dst);
+	}
+
+
+	static void make_image(gray::view_t const& view_src, gray::image_t& image_dst)
+	{
+		make_image(image_dst, view_src.width, view_src.height);
+
+		auto dst = image_dst.data;
+
+		for_each_row(view_src, [&](gray::pixel_t* row, u32 width)
+		{
+			std::copy(row, row + width, dst);
+			dst += width;
+		});
+	}
+
+
+	void write_view(gray::view_t const& view_src, const char* file_path_dst)
+	{
+		gray::image_t image;
+		make_image(view_src, image);
+
+		write_image(image, file_path_dst);
+	}
+
 
+	void write_view(gray::view_t const& view_src, const char* file_path_dst, arena_t& scratch)
+	{
+		auto data = push_array<gray::pixel_t>(scratch, static_cast<size_t>(view_src.width) * view_src.height);
 		assert(data);
-		assert(width);
-		assert(height);
 
-		image_dst.data = data;
-		image_dst.width = width;
-		image_dst.height = height;
+		auto dst = data;
+
+		for_each_row(view_src, [&](gray::pixel_t* row, u32 width)
+		{
+			std::copy(row, row + width, dst);
+			dst += width;
+		});
+
+		write_pixels(data, view_src.width, view_src.height, 1, file_path_dst);
 	}
 
+#endif // !LIBIMAGE_NO_WRITE
+
 
-	void make_image(gray::image_t& image_dst, u32 width, u32 height)
+#ifndef LIBIMAGE_NO_RESIZE
+
+	void resize_image(gray::image_t const& image_src, gray::image_t& image_dst)
 	{
-		assert(width);
-		assert(height);
+		assert(image_src.width);
+		assert(image_src.height);
+		assert(image_src.data);
+		assert(image_dst.width);
+		assert(image_dst.height);
 
-		image_dst.width = width;
-		image_dst.height = height;
-		image_dst.data = (gray::pixel_t*)malloc(sizeof(gray::pixel_t) * width * height);
+		int channels = 1;
 
-		assert(image_dst.data);
+		int width_src = static_cast<int>(image_src.width);
+		int height_src = static_cast<int>(image_src.height);
+
+		int width_dst = static_cast<int>(image_dst.width);
+		int height_dst = static_cast<int>(image_dst.height);
+
+		int result = 0;
+
+		image_dst.data = (gray::pixel_t*)realloc_pixels(image_dst.data, sizeof(gray::pixel_t) * image_dst.width * image_dst.height);
+
+		result = resize_uint8(
+			(u8*)image_src.data, width_src, height_src,
+			(u8*)image_dst.data, width_dst, height_dst,
+			channels);
+
+		assert(result);
 	}
 
 
-	gray::view_t make_view(gray::image_t const& img)
+	gray::view_t make_resized_view(gray::image_t const& image_src, gray::image_t& image_dst)
 	{
-		assert(img.width);
-		assert(img.height);
-		assert(img.data);
+		resize_image(image_src, image_dst);
 
-		gray::view_t view;
+		return make_view(image_dst);
+	}
 
-		view.image_data = img.data;
-		view.image_width = img.width;
-		view.x_begin = 0;
-		view.y_begin = 0;
-		view.x_end = img.width;
-		view.y_end = img.height;
-		view.width = img.width;
-		view.height = img.height;
+#endif // !LIBIMAGE_NO_RESIZE
 
-		return view;
+#endif // !#ifndef LIBIMAGE_NO_GRAYSCALE
+
+#ifndef LIBIMAGE_NO_MATH
+
+
+	template <size_t N>
+	static void scale_down(hist_t<N>& hist, u32 width, u32 height)
+	{
+		// reduce quanities to delay overflow
+		auto const total_size = static_cast<size_t>(width) * height;
+
+		assert(total_size <= UINT32_MAX);
+		auto const total32 = static_cast<u32>(total_size);
+
+		if (total32 < 10000u)
+			return;
+
+		auto const divisor = 10 * (total32 / 10000u);
+		for (auto& qty : hist)
+		{
+			qty /= divisor;
+		}
 	}
 
 
-	gray::view_t sub_view(gray::image_t const& image, pixel_range_t const& range)
+	constexpr u32 log2_u32(size_t n) { return n <= 1 ? 0 : 1 + log2_u32(n / 2); }
+
+
+	// histogram buckets are the high bits of the value being counted
+	// the shift is known at compile time for each number of buckets
+
+	template <size_t N>
+	constexpr u32 gray_hist_shift()
 	{
-		assert(image.width);
-		assert(image.height);
-		assert(image.data);
+		static_assert(N >= 2 && (N & (N - 1)) == 0, "histogram buckets must be a power of 2");
+		static_assert(N <= CHANNEL_SIZE, "too many histogram buckets");
 
-		gray::view_t sub_view;
+		return 8 - log2_u32(N);
+	}
 
-		sub_view.image_data = image.data;
-		sub_view.image_width = image.width;
-		sub_view.x_begin = range.x_begin;
-		sub_view.y_begin = range.y_begin;
-		sub_view.x_end = range.x_end;
-		sub_view.y_end = range.y_end;
-		sub_view.width = range.x_end - range.x_begin;
-		sub_view.height = range.y_end - range.y_begin;
 
-		assert(sub_view.width);
-		assert(sub_view.height);
+	// packed value red << 16 | green << 8 | blue
+	template <size_t N>
+	constexpr u32 rgb_hist_shift()
+	{
+		static_assert(N >= 2 && (N & (N - 1)) == 0, "histogram buckets must be a power of 2");
+		static_assert(N <= 4096, "too many histogram buckets");
 
-		return sub_view;
+		return 24 - log2_u32(N);
 	}
 
 
-	gray::view_t sub_view(gray::view_t const& view, pixel_range_t const& range)
+	// rows per band for parallel histograms and stats
+	constexpr u32 BAND_ROWS = 64;
+
+
+	static u32 n_bands(u32 height)
 	{
-		assert(view.width);
-		assert(view.height);
-		assert(view.image_data);
+		return (height + BAND_ROWS - 1) / BAND_ROWS;
+	}
 
-		assert(range.x_begin >= view.x_begin);
-		assert(range.x_end <= view.x_end);
-		assert(range.y_begin >= view.y_begin);
-		assert(range.y_end <= view.y_end);
 
-		gray::view_t sub_view;
+	// band_func(PARTIAL& partial, u32 y_begin, u32 y_end) counts each band of rows into a partial on the stack
+	// add_func(PARTIAL const& partial) is called by one thread at a time for each partial
+	// counts are integers so the total does not depend on how bands are shared between threads
+	template <class PARTIAL, class BAND_F, class ADD_F>
+	static void reduce_bands(u32 height, BAND_F const& band_func, ADD_F const& add_func)
+	{
+		std::mutex add_mutex;
 
-		sub_view.image_data = view.image_data;
-		sub_view.image_width = view.image_width;
-		sub_view.x_begin = view.x_begin + range.x_begin;
-		sub_view.y_begin = view.y_begin + range.y_begin;
-		sub_view.x_end = view.x_begin + range.x_end;
-		sub_view.y_end = view.y_begin + range.y_end;
-		sub_view.width = range.x_end - range.x_begin;
-		sub_view.height = range.y_end - range.y_begin;
+		auto const run_bands = [&](u32 band_begin, u32 band_end)
+		{
+			PARTIAL partial = {};
 
-		assert(sub_view.width);
-		assert(sub_view.height);
+			for (u32 band = band_begin; band < band_end; ++band)
+			{
+				u32 y_begin = band * BAND_ROWS;
+				u32 y_end = std::min(y_begin + BAND_ROWS, height);
 
-		return sub_view;
+				band_func(partial, y_begin, y_end);
+			}
+
+			std::lock_guard<std::mutex> lock(add_mutex);
+			add_func(partial);
+		};
+
+#ifdef LIBIMAGE_NO_PARALLEL
+
+		run_bands(0, n_bands(height));
+
+#else
+
+		parallel_for(0, n_bands(height), run_bands);
+
+#endif // LIBIMAGE_NO_PARALLEL
 	}
 
 
-	gray::view_t row_view(gray::image_t const& image, u32 y)
+	// histogram buckets compared several at a time
+	// u32 differences are added into u64 lanes so that large counts do not overflow
+
+#if defined(LIBIMAGE_AVX2)
+
+	using hist_lanes_t = __m256i;
+
+	constexpr size_t HIST_LANES = 8;
+
+
+	static hist_lanes_t load_lanes(u32 const* src) { return _mm256_loadu_si256((__m256i const*)src); }
+
+
+	static hist_lanes_t zero_lanes() { return _mm256_setzero_si256(); }
+
+
+	static void min_max_lanes(hist_lanes_t a, hist_lanes_t b, hist_lanes_t& lo, hist_lanes_t& hi)
 	{
-		pixel_range_t range;
-		range.x_begin = 0;
-		range.x_end = image.width;
-		range.y_begin = y;
-		range.y_end = y + 1;
+		lo = _mm256_min_epu32(a, b);
+		hi = _mm256_max_epu32(a, b);
+	}
 
-		return sub_view(image, range);
+
+	static hist_lanes_t sub_lanes(hist_lanes_t a, hist_lanes_t b) { return _mm256_sub_epi32(a, b); }
+
+
+	static hist_lanes_t add_wide_lanes(hist_lanes_t acc, hist_lanes_t v)
+	{
+		auto const zero = _mm256_setzero_si256();
+
+		acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, zero));
+		return _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, zero));
 	}
 
 
-	gray::view_t row_view(gray::view_t const& view, u32 y)
+	static u64 sum_wide_lanes(hist_lanes_t acc)
 	{
-		pixel_range_t range;
-		range.x_begin = 0;
-		range.x_end = view.width;
-		range.y_begin = y;
-		range.y_end = y + 1;
+		alignas(32) u64 lanes[4];
+		_mm256_store_si256((__m256i*)lanes, acc);
+
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+
+#elif defined(LIBIMAGE_SSE2)
+
+	using hist_lanes_t = __m128i;
+
+	constexpr size_t HIST_LANES = 4;
+
+
+	static hist_lanes_t load_lanes(u32 const* src) { return _mm_loadu_si128((__m128i const*)src); }
+
+
+	static hist_lanes_t zero_lanes() { return _mm_setzero_si128(); }
+
+
+	static void min_max_lanes(hist_lanes_t a, hist_lanes_t b, hist_lanes_t& lo, hist_lanes_t& hi)
+	{
+		// SSE2 only compares signed values
+		auto const bias = _mm_set1_epi32((int)0x80000000);
+		auto a_gt_b = _mm_cmpgt_epi32(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+
+		lo = _mm_or_si128(_mm_and_si128(a_gt_b, b), _mm_andnot_si128(a_gt_b, a));
+		hi = _mm_or_si128(_mm_and_si128(a_gt_b, a), _mm_andnot_si128(a_gt_b, b));
+	}
+
+
+	static hist_lanes_t sub_lanes(hist_lanes_t a, hist_lanes_t b) { return _mm_sub_epi32(a, b); }
+
+
+	static hist_lanes_t add_wide_lanes(hist_lanes_t acc, hist_lanes_t v)
+	{
+		auto const zero = _mm_setzero_si128();
+
+		acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+		return _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+	}
+
+
+	static u64 sum_wide_lanes(hist_lanes_t acc)
+	{
+		alignas(16) u64 lanes[2];
+		_mm_store_si128((__m128i*)lanes, acc);
+
+		return lanes[0] + lanes[1];
+	}
+
+#endif
+
+
+	template <size_t N>
+	u64 hist_distance(hist_t<N> const& lhs, hist_t<N> const& rhs)
+	{
+		u64 total = 0;
+		size_t i = 0;
+
+#if defined(LIBIMAGE_AVX2) || defined(LIBIMAGE_SSE2)
+
+		auto acc = zero_lanes();
+		hist_lanes_t lo;
+		hist_lanes_t hi;
+
+		for (; i + HIST_LANES <= N; i += HIST_LANES)
+		{
+			min_max_lanes(load_lanes(lhs.data() + i), load_lanes(rhs.data() + i), lo, hi);
+			acc = add_wide_lanes(acc, sub_lanes(hi, lo));
+		}
+
+		total = sum_wide_lanes(acc);
+
+#endif
+
+		for (; i < N; ++i)
+		{
+			total += lhs[i] > rhs[i] ? lhs[i] - rhs[i] : rhs[i] - lhs[i];
+		}
+
+		return total;
+	}
+
+
+	template <size_t N>
+	u64 hist_intersection(hist_t<N> const& lhs, hist_t<N> const& rhs)
+	{
+		u64 total = 0;
+		size_t i = 0;
+
+#if defined(LIBIMAGE_AVX2) || defined(LIBIMAGE_SSE2)
+
+		auto acc = zero_lanes();
+		hist_lanes_t lo;
+		hist_lanes_t hi;
+
+		for (; i + HIST_LANES <= N; i += HIST_LANES)
+		{
+			min_max_lanes(load_lanes(lhs.data() + i), load_lanes(rhs.data() + i), lo, hi);
+			acc = add_wide_lanes(acc, lo);
+		}
+
+		total = sum_wide_lanes(acc);
+
+#endif
+
+		for (; i < N; ++i)
+		{
+			total += std::min(lhs[i], rhs[i]);
+		}
+
+		return total;
+	}
+
+
+#ifndef LIBIMAGE_NO_COLOR
+
+	// neighboring pixels count into different histograms
+	// so that consecutive increments of the same bucket do not wait on each other
+	constexpr u32 N_SUB_HISTS = 4;
+
+	template <size_t N>
+	using sub_hists_t = std::array<hist_t<N>, N_SUB_HISTS>;
+
+
+	// bucket is the high bits of the packed value red << 16 | green << 8 | blue
+	template <size_t N>
+	struct packed_rgb_buckets
+	{
+		static constexpr size_t count = N;
+		static constexpr u32 shift = rgb_hist_shift<N>();
+
+		static u32 bucket(pixel_t const& p)
+		{
+			u32 rgb = static_cast<u32>(p.red) << 16 | static_cast<u32>(p.green) << 8 | p.blue;
+
+			return rgb >> shift;
+		}
+
+#if defined(LIBIMAGE_AVX2)
+
+		static __m256i bucket(__m256i px)
+		{
+			auto const byte_mask = _mm256_set1_epi32(0xFF);
+			auto const green_mask = _mm256_set1_epi32(0xFF00);
+
+			auto red = _mm256_slli_epi32(_mm256_and_si256(px, byte_mask), 16);
+			auto green = _mm256_and_si256(px, green_mask);
+			auto blue = _mm256_and_si256(_mm256_srli_epi32(px, 16), byte_mask);
+			auto rgb = _mm256_or_si256(_mm256_or_si256(red, green), blue);
+
+			return _mm256_srli_epi32(rgb, shift);
+		}
+
+#elif defined(LIBIMAGE_SSE2)
+
+		static __m128i bucket(__m128i px)
+		{
+			auto const byte_mask = _mm_set1_epi32(0xFF);
+			auto const green_mask = _mm_set1_epi32(0xFF00);
+
+			auto red = _mm_slli_epi32(_mm_and_si128(px, byte_mask), 16);
+			auto green = _mm_and_si128(px, green_mask);
+			auto blue = _mm_and_si128(_mm_srli_epi32(px, 16), byte_mask);
+			auto rgb = _mm_or_si128(_mm_or_si128(red, green), blue);
+
+			return _mm_srli_epi32(rgb, shift);
+		}
+
+#endif
+	};
+
+
+	// bucket is red << 2 * BITS | green << BITS | blue, using the high BITS of each channel
+	template <u32 BITS>
+	struct joint_rgb_buckets
+	{
+		static_assert(BITS >= 1 && BITS <= 4, "joint histograms use 1 to 4 bits per channel");
+
+		static constexpr size_t count = color_hist_buckets<BITS>();
+		static constexpr u32 mask = (1u << BITS) - 1;
+
+		static u32 bucket(pixel_t const& p)
+		{
+			u32 r = p.red >> (8 - BITS);
+			u32 g = p.green >> (8 - BITS);
+			u32 b = p.blue >> (8 - BITS);
+
+			return r << (2 * BITS) | g << BITS | b;
+		}
+
+#if defined(LIBIMAGE_AVX2)
+
+		static __m256i bucket(__m256i px)
+		{
+			auto const byte_mask = _mm256_set1_epi32(0xFF);
+			auto const bits_mask = _mm256_set1_epi32(mask);
+
+			// pixel bytes are red, green, blue, alpha from low to high
+			auto r = _mm256_srli_epi32(_mm256_and_si256(px, byte_mask), 8 - BITS);
+			auto g = _mm256_and_si256(_mm256_srli_epi32(px, 16 - BITS), bits_mask);
+			auto b = _mm256_and_si256(_mm256_srli_epi32(px, 24 - BITS), bits_mask);
+
+			r = _mm256_slli_epi32(r, 2 * BITS);
+			g = _mm256_slli_epi32(g, BITS);
+
+			return _mm256_or_si256(_mm256_or_si256(r, g), b);
+		}
 
-		return sub_view(view, range);
-	}
+#elif defined(LIBIMAGE_SSE2)
 
+		static __m128i bucket(__m128i px)
+		{
+			auto const byte_mask = _mm_set1_epi32(0xFF);
+			auto const bits_mask = _mm_set1_epi32(mask);
 
-	gray::view_t column_view(gray::image_t const& image, u32 x)
-	{
-		pixel_range_t range;
-		range.x_begin = x;
-		range.x_end = x + 1;
-		range.y_begin = 0;
-		range.y_end = image.height;
+			// pixel bytes are red, green, blue, alpha from low to high
+			auto r = _mm_srli_epi32(_mm_and_si128(px, byte_mask), 8 - BITS);
+			auto g = _mm_and_si128(_mm_srli_epi32(px, 16 - BITS), bits_mask);
+			auto b = _mm_and_si128(_mm_srli_epi32(px, 24 - BITS), bits_mask);
 
-		return sub_view(image, range);
-	}
+			r = _mm_slli_epi32(r, 2 * BITS);
+			g = _mm_slli_epi32(g, BITS);
+
+			return _mm_or_si128(_mm_or_si128(r, g), b);
+		}
 
+#endif
+	};
 
-	gray::view_t column_view(gray::view_t const& view, u32 x)
+
+	template <class BUCKETS>
+	static void update_hists_scalar(pixel_t const* row, u32 x_begin, u32 x_end, sub_hists_t<BUCKETS::count>& hists)
 	{
-		pixel_range_t range;
-		range.x_begin = x;
-		range.x_end = x + 1;
-		range.y_begin = 0;
-		range.y_end = view.height;
+		u32 x = x_begin;
 
-		return sub_view(view, range);
+		for (; x + N_SUB_HISTS <= x_end; x += N_SUB_HISTS)
+		{
+			++hists[0][BUCKETS::bucket(row[x])];
+			++hists[1][BUCKETS::bucket(row[x + 1])];
+			++hists[2][BUCKETS::bucket(row[x + 2])];
+			++hists[3][BUCKETS::bucket(row[x + 3])];
+		}
+
+		for (; x < x_end; ++x)
+		{
+			++hists[0][BUCKETS::bucket(row[x])];
+		}
 	}
 
 
-	gray::view_t row_view(gray::image_t const& image, u32 x_begin, u32 x_end, u32 y)
+#if defined(LIBIMAGE_AVX2)
+
+	template <class BUCKETS>
+	static void update_hists(pixel_t const* row, u32 width, sub_hists_t<BUCKETS::count>& hists)
 	{
-		pixel_range_t range;
-		range.x_begin = x_begin;
-		range.x_end = x_end;
-		range.y_begin = y;
-		range.y_end = y + 1;
+		alignas(32) u32 buckets[8];
 
-		return sub_view(image, range);
+		u32 x = 0;
+
+		for (; x + 8 <= width; x += 8)
+		{
+			auto px = _mm256_loadu_si256((__m256i const*)(row + x));
+
+			_mm256_store_si256((__m256i*)buckets, BUCKETS::bucket(px));
+
+			++hists[0][buckets[0]];
+			++hists[1][buckets[1]];
+			++hists[2][buckets[2]];
+			++hists[3][buckets[3]];
+			++hists[0][buckets[4]];
+			++hists[1][buckets[5]];
+			++hists[2][buckets[6]];
+			++hists[3][buckets[7]];
+		}
+
+		update_hists_scalar<BUCKETS>(row, x, width, hists);
 	}
 
+#elif defined(LIBIMAGE_SSE2)
 
-	gray::view_t row_view(gray::view_t const& view, u32 x_begin, u32 x_end, u32 y)
+	template <class BUCKETS>
+	static void update_hists(pixel_t const* row, u32 width, sub_hists_t<BUCKETS::count>& hists)
 	{
-		pixel_range_t range;
-		range.x_begin = x_begin;
-		range.x_end = x_end;
-		range.y_begin = y;
-		range.y_end = y + 1;
+		alignas(16) u32 buckets[4];
 
-		return sub_view(view, range);
-	}
+		u32 x = 0;
 
+		for (; x + 4 <= width; x += 4)
+		{
+			auto px = _mm_loadu_si128((__m128i const*)(row + x));
 
-	gray::view_t column_view(gray::image_t const& image, u32 y_begin, u32 y_end, u32 x)
-	{
-		pixel_range_t range;
-		range.x_begin = x;
-		range.x_end = x + 1;
-		range.y_begin = y_begin;
-		range.y_end = y_end;
+			_mm_store_si128((__m128i*)buckets, BUCKETS::bucket(px));
 
-		return sub_view(image, range);
+			++hists[0][buckets[0]];
+			++hists[1][buckets[1]];
+			++hists[2][buckets[2]];
+			++hists[3][buckets[3]];
+		}
+
+		update_hists_scalar<BUCKETS>(row, x, width, hists);
 	}
 
+#else
 
-	gray::view_t column_view(gray::view_t const& view, u32 y_begin, u32 y_end, u32 x)
+	template <class BUCKETS>
+	static void update_hists(pixel_t const* row, u32 width, sub_hists_t<BUCKETS::count>& hists)
 	{
-		pixel_range_t range;
-		range.x_begin = x;
-		range.x_end = x + 1;
-		range.y_begin = y_begin;
-		range.y_end = y_end;
-
-		return sub_view(view, range);
+		update_hists_scalar<BUCKETS>(row, 0, width, hists);
 	}
 
+#endif
 
-#ifndef LIBIMAGE_NO_WRITE
 
-	void write_image(gray::image_t const& image_src, const char* file_path_dst)
+	template <size_t N>
+	static hist_t<N> sum_hists(sub_hists_t<N> const& hists)
 	{
-		assert(image_src.width);
-		assert(image_src.height);
-		assert(image_src.data);
+		hist_t<N> hist = { 0 };
 
-		int width = static_cast<int>(image_src.width);
-		int height = static_cast<int>(image_src.height);
-		int channels = 1;
-		auto const data = image_src.data;
+		for (auto const& sub : hists)
+		{
+			for (u32 bucket = 0; bucket < N; ++bucket)
+			{
+				hist[bucket] += sub[bucket];
+			}
+		}
 
-		int result = 0;
+		return hist;
+	}
 
-		auto ext = fs::path(file_path_dst).extension();
 
-		assert(ext == ".bmp" || ext == ".png");
+	template <class BUCKETS>
+	static hist_t<BUCKETS::count> calc_bucket_hist(view_t const& view)
+	{
+		constexpr auto N = BUCKETS::count;
 
-		if (ext == ".bmp" || ext == ".BMP")
-		{
-			result = stbi_write_bmp(file_path_dst, width, height, channels, data);
-		}
-		else if (ext == ".png" || ext == ".PNG")
+		hist_t<N> hist = { 0 };
+
+		auto const count_rows = [&](sub_hists_t<N>& hists, u32 y_begin, u32 y_end)
 		{
-			int stride_in_bytes = width * channels;
+			for (u32 y = y_begin; y < y_end; ++y)
+			{
+				update_hists<BUCKETS>(view.row_begin(y), view.width, hists);
+			}
+		};
 
-			result = stbi_write_png(file_path_dst, width, height, channels, data, stride_in_bytes);
-		}
-		else if (ext == ".jpg" || ext == ".jpeg" || ext == ".JPG" || ext == ".JPEG")
+		auto const add_hists = [&](sub_hists_t<N> const& hists)
 		{
-			// TODO: quality?
-			// stbi_write_jpg(char const *filename, int w, int h, int comp, const void *data, int quality);
-		}
+			auto partial_hist = sum_hists<N>(hists);
 
-		assert(result);
-	}
+			for (u32 bucket = 0; bucket < N; ++bucket)
+			{
+				hist[bucket] += partial_hist[bucket];
+			}
+		};
 
+		reduce_bands<sub_hists_t<N>>(view.height, count_rows, add_hists);
 
-	static void make_image(gray::view_t const& view_src, gray::image_t& image_dst)
-	{
-		make_image(image_dst, view_src.width, view_src.height);
+		scale_down(hist, view.width, view.height);
 
-		std::transform(view_src.begin(), view_src.end(), image_dst.begin(), [](auto p) { return p; });
+		return hist;
 	}
 
 
-	void write_view(gray::view_t const& view_src, const char* file_path_dst)
+	template <size_t N>
+	hist_t<N> calc_hist(view_t const& view)
 	{
-		gray::image_t image;
-		make_image(view_src, image);
+		return calc_bucket_hist<packed_rgb_buckets<N>>(view);
+	}
 
-		write_image(image, file_path_dst);
+
+	template <u32 BITS>
+	color_hist_t<BITS> calc_color_hist(view_t const& view)
+	{
+		return calc_bucket_hist<joint_rgb_buckets<BITS>>(view);
 	}
 
-#endif // !LIBIMAGE_NO_WRITE
 
+	template <size_t N>
+	static size_t corner_offset(integral_hist_t<N> const& integral, u32 cx, u32 cy)
+	{
+		return (static_cast<size_t>(cy) * (integral.cells_x + 1) + cx) * N;
+	}
 
-#ifndef LIBIMAGE_NO_RESIZE
 
-	void resize_image(gray::image_t const& image_src, gray::image_t& image_dst)
+	template <class BUCKETS>
+	static void make_bucket_integral_hist(integral_hist_t<BUCKETS::count>& dst, view_t const& view, u32 cell_size, arena_t& arena)
 	{
-		assert(image_src.width);
-		assert(image_src.height);
-		assert(image_src.data);
-		assert(image_dst.width);
-		assert(image_dst.height);
+		constexpr auto N = BUCKETS::count;
 
-		int channels = 1;
+		assert(view.width);
+		assert(view.height);
+		assert(cell_size);
 
-		int width_src = static_cast<int>(image_src.width);
-		int height_src = static_cast<int>(image_src.height);
-		int stride_bytes_src = width_src * channels;
+		dst.width = view.width;
+		dst.height = view.height;
+		dst.cell_size = cell_size;
+		dst.cells_x = (view.width + cell_size - 1) / cell_size;
+		dst.cells_y = (view.height + cell_size - 1) / cell_size;
 
-		int width_dst = static_cast<int>(image_dst.width);
-		int height_dst = static_cast<int>(image_dst.height);
-		int stride_bytes_dst = width_dst * channels;
+		auto n_counts = static_cast<size_t>(dst.cells_x + 1) * (dst.cells_y + 1) * N;
 
-		int result = 0;
+		dst.counts = push_array<u32>(arena, n_counts);
+		assert(dst.counts);
 
-		image_dst.data = (gray::pixel_t*)malloc(sizeof(gray::pixel_t) * image_dst.width * image_dst.height);
+		// first row and column of corners stay 0
+		std::fill(dst.counts, dst.counts + n_counts, 0u);
 
-		result = stbir_resize_uint8(
-			(u8*)image_src.data, width_src, height_src, stride_bytes_src,
-			(u8*)image_dst.data, width_dst, height_dst, stride_bytes_dst,
-			channels);
+		// count each cell and sum across each row of cells
+		auto const count_cell_rows = [&](u32 cy_begin, u32 cy_end)
+		{
+			for (u32 cy = cy_begin; cy < cy_end; ++cy)
+			{
+				u32 y_begin = cy * cell_size;
+				u32 y_end = std::min(y_begin + cell_size, view.height);
 
-		assert(result);
-	}
+				for (u32 y = y_begin; y < y_end; ++y)
+				{
+					auto row = view.row_begin(y);
 
+					for (u32 cx = 0; cx < dst.cells_x; ++cx)
+					{
+						auto cell = dst.counts + corner_offset(dst, cx + 1, cy + 1);
 
-	gray::view_t make_resized_view(gray::image_t const& image_src, gray::image_t& image_dst)
-	{
-		resize_image(image_src, image_dst);
+						u32 x_begin = cx * cell_size;
+						u32 x_end = std::min(x_begin + cell_size, view.width);
 
-		return make_view(image_dst);
-	}
+						for (u32 x = x_begin; x < x_end; ++x)
+						{
+							++cell[BUCKETS::bucket(row[x])];
+						}
+					}
+				}
 
-#endif // !LIBIMAGE_NO_RESIZE
+				for (u32 cx = 1; cx < dst.cells_x; ++cx)
+				{
+					auto left = dst.counts + corner_offset(dst, cx, cy + 1);
+					auto cell = dst.counts + corner_offset(dst, cx + 1, cy + 1);
 
-#endif // !#ifndef LIBIMAGE_NO_GRAYSCALE
+					for (u32 bucket = 0; bucket < N; ++bucket)
+					{
+						cell[bucket] += left[bucket];
+					}
+				}
+			}
+		};
 
-#ifndef LIBIMAGE_NO_MATH
+#ifdef LIBIMAGE_NO_PARALLEL
 
+		count_cell_rows(0, dst.cells_y);
 
-	static void scale_down(hist_t& hist, u32 width, u32 height)
-	{
-		// reduce quanities to delay overflow
-		auto const total_size = static_cast<size_t>(width) * height;
+#else
 
-		assert(total_size <= UINT32_MAX);
-		auto const total32 = static_cast<u32>(total_size);
+		parallel_for(0, dst.cells_y, count_cell_rows);
 
-		if (total32 < 10000u)
-			return;
+#endif // LIBIMAGE_NO_PARALLEL
 
-		auto const divisor = 10 * (total32 / 10000u);
-		std::for_each(std::execution::par, hist.begin(), hist.end(), [&](auto& qty) { qty /= divisor; });
+		// sum down each column of corners
+		auto const row_size = static_cast<size_t>(dst.cells_x + 1) * N;
+
+		for (u32 cy = 2; cy <= dst.cells_y; ++cy)
+		{
+			auto above = dst.counts + corner_offset(dst, 0, cy - 1);
+			auto row = dst.counts + corner_offset(dst, 0, cy);
+
+			for (size_t i = 0; i < row_size; ++i)
+			{
+				row[i] += above[i];
+			}
+		}
 	}
 
 
-#ifndef LIBIMAGE_NO_COLOR
+	template <size_t N>
+	void make_integral_hist(integral_hist_t<N>& dst, view_t const& view, u32 cell_size, arena_t& arena)
+	{
+		make_bucket_integral_hist<packed_rgb_buckets<N>>(dst, view, cell_size, arena);
+	}
 
-	hist_t calc_hist(view_t const& view) // TODO: untested
+
+	template <u32 BITS>
+	void make_color_integral_hist(color_integral_hist_t<BITS>& dst, view_t const& view, u32 cell_size, arena_t& arena)
+	{
+		make_bucket_integral_hist<joint_rgb_buckets<BITS>>(dst, view, cell_size, arena);
+	}
+
+
+	template <size_t N>
+	hist_t<N> calc_hist(integral_hist_t<N> const& integral, pixel_range_t const& range)
 	{
-		auto const to_1d = [&](u8 red, u8 green, u8 blue) 
+		assert(integral.cell_size);
+		assert(range.x_begin < range.x_end);
+		assert(range.y_begin < range.y_end);
+		assert(range.x_end <= integral.width);
+		assert(range.y_end <= integral.height);
+
+		auto const cell_size = integral.cell_size;
+
+		auto const nearest_cell = [&](u32 pos, u32 n_cells)
 		{
-			return red * CHANNEL_SIZE * CHANNEL_SIZE + green * CHANNEL_SIZE + blue;
+			return std::min((pos + cell_size / 2) / cell_size, n_cells);
 		};
 
-		auto divisor = to_1d(255, 255, 255) / N_HIST_BUCKETS;
+		u32 cx_begin = nearest_cell(range.x_begin, integral.cells_x);
+		u32 cx_end = nearest_cell(range.x_end, integral.cells_x);
+		u32 cy_begin = nearest_cell(range.y_begin, integral.cells_y);
+		u32 cy_end = nearest_cell(range.y_end, integral.cells_y);
+
+		// at least one cell
+		if (cx_end == cx_begin)
+		{
+			cx_begin = std::min(cx_begin, integral.cells_x - 1);
+			cx_end = cx_begin + 1;
+		}
+
+		if (cy_end == cy_begin)
+		{
+			cy_begin = std::min(cy_begin, integral.cells_y - 1);
+			cy_end = cy_begin + 1;
+		}
+
+		auto const counts = integral.counts;
 
-		hist_t hist = { 0 };
+		auto const top_left = counts + corner_offset(integral, cx_begin, cy_begin);
+		auto const top_right = counts + corner_offset(integral, cx_end, cy_begin);
+		auto const bottom_left = counts + corner_offset(integral, cx_begin, cy_end);
+		auto const bottom_right = counts + corner_offset(integral, cx_end, cy_end);
 
-		auto const update = [&](pixel_t const& p) 
+		hist_t<N> hist = { 0 };
+
+		for (u32 bucket = 0; bucket < N; ++bucket)
 		{
-			auto bucket = to_1d(p.red, p.green, p.blue) / divisor;
-			++hist[bucket];
-		};
+			hist[bucket] = bottom_right[bucket] - bottom_left[bucket] - top_right[bucket] + top_left[bucket];
+		}
 
-		std::for_each(view.begin(), view.end(), update);
+		u32 width = std::min(cx_end * cell_size, integral.width) - cx_begin * cell_size;
+		u32 height = std::min(cy_end * cell_size, integral.height) - cy_begin * cell_size;
 
-		scale_down(hist, view.width, view.height);
+		scale_down(hist, width, height);
 
 		return hist;
 	}
@@ -682,28 +2402,56 @@ namespace libimage
 
 		auto const divisor = CHANNEL_SIZE / N_HIST_BUCKETS;
 
-		std::array<hist_t, n_channels> c_hists = { 0 };
-		std::array<r32, n_channels> c_counts = { 0 };
+		typedef struct band_stats_t
+		{
+			std::array<hist_t<>, n_channels> hists;
+			std::array<u64, n_channels> sums;
+
+		} BandStats;
+
+		std::array<hist_t<>, n_channels> c_hists = { 0 };
+		std::array<u64, n_channels> c_counts = { 0 };
+
+		auto const count_rows = [&](BandStats& stats, u32 y_begin, u32 y_end)
+		{
+			for (u32 y = y_begin; y < y_end; ++y)
+			{
+				auto row = view.row_begin(y);
+
+				for (u32 x = 0; x < view.width; ++x)
+				{
+					for (u32 c = 0; c < n_channels; ++c)
+					{
+						auto shade = row[x].channels[c];
+
+						++stats.hists[c][shade / divisor];
+						stats.sums[c] += shade;
+					}
+				}
+			}
+		};
 
-		auto const update = [&](pixel_t const& p)
+		auto const add_stats = [&](BandStats const& stats)
 		{
 			for (u32 c = 0; c < n_channels; ++c)
 			{
-				auto bucket = p.channels[c] / divisor;
+				for (u32 bucket = 0; bucket < N_HIST_BUCKETS; ++bucket)
+				{
+					c_hists[c][bucket] += stats.hists[c][bucket];
+				}
 
-				++c_hists[c][bucket];
-				c_counts[c] += p.channels[c];
+				c_counts[c] += stats.sums[c];
 			}
 		};
 
-		std::for_each(view.begin(), view.end(), update);
+		reduce_bands<BandStats>(view.height, count_rows, add_stats);
 
 		auto num_pixels = static_cast<size_t>(view.width) * view.height;
 
-		auto c_means = c_counts;
+		std::array<r32, n_channels> c_means = { 0 };
 		for (u32 c = 0; c < n_channels; ++c)
 		{
-			c_means[c] /= num_pixels;
+			c_means[c] = static_cast<r32>(static_cast<r64>(c_counts[c]) / num_pixels);
 		}
 
 		std::array<r32, n_channels> c_diff_sq_totals = { 0 };
@@ -788,7 +2536,7 @@ namespace libimage
 					pixel_t color = to_pixel(0, 0, 0, 255);
 					color.channels[c] = shade;
 					auto bar_view = sub_view(image_dst, bar_range);
-					std::fill(bar_view.begin(), bar_view.end(), color);
+					for_each_row(bar_view, [&](pixel_t* row, u32 width) { std::fill(row, row + width, color); });
 				}
 
 				bar_range.x_begin += (bucket_spacing + bucket_width);
@@ -798,7 +2546,8 @@ namespace libimage
 	}
 
 
-	void draw_histogram(hist_t const& hist, view_t& view_dst, pixel_t const& color) // TODO: untested
+	template <size_t N>
+	void draw_histogram(hist_t<N> const& hist, view_t& view_dst, pixel_t const& color) // TODO: untested
 	{
 		assert(view_dst.width);
 		assert(view_dst.height);
@@ -809,10 +2558,12 @@ namespace libimage
 
 		u32 const max_relative_qty = v_height - 1;
 
-		u32 const n_buckets = static_cast<u32>(N_HIST_BUCKETS);
+		u32 const n_buckets = static_cast<u32>(N);
 
 		u32 const bucket_spacing = 1;
 
+		assert(v_width > n_buckets * (bucket_spacing + 1));
+
 		u32 const bucket_width = (v_width - bucket_spacing) / n_buckets - bucket_spacing;
 
 		auto max = std::accumulate(hist.begin(), hist.end(), 0.0f);
@@ -835,7 +2586,7 @@ namespace libimage
 			if (bar_range.y_end > bar_range.y_begin)
 			{
 				auto bar_view = sub_view(view_dst, bar_range);
-				std::fill(bar_view.begin(), bar_view.end(), color);
+				for_each_row(bar_view, [&](pixel_t* row, u32 width) { std::fill(row, row + width, color); });
 			}
 
 			bar_range.x_begin += (bucket_spacing + bucket_width);
@@ -847,51 +2598,72 @@ namespace libimage
 
 #ifndef LIBIMAGE_NO_GRAYSCALE
 
-	hist_t calc_hist(gray::view_t const& view) // TODO: untested
+	template <size_t N>
+	struct gray_band_stats_t
 	{
-		assert(N_HIST_BUCKETS <= CHANNEL_SIZE);
+		hist_t<N> hist;
+		u64 sum;
+	};
 
-		hist_t hist = { 0 };
-		r32 count = 0.0f;
 
-		auto const divisor = CHANNEL_SIZE / N_HIST_BUCKETS;
+	template <size_t N>
+	static gray_band_stats_t<N> calc_band_stats(gray::view_t const& view)
+	{
+		constexpr auto shift = gray_hist_shift<N>();
+
+		gray_band_stats_t<N> total = {};
 
-		auto const update = [&](gray::pixel_t const& shade)
+		auto const count_rows = [&](gray_band_stats_t<N>& stats, u32 y_begin, u32 y_end)
 		{
-			auto bucket = shade / divisor;
-			++hist[bucket];
-			count += shade;
+			for (u32 y = y_begin; y < y_end; ++y)
+			{
+				auto row = view.row_begin(y);
+
+				for (u32 x = 0; x < view.width; ++x)
+				{
+					++stats.hist[row[x] >> shift];
+					stats.sum += row[x];
+				}
+			}
 		};
 
-		std::for_each(view.begin(), view.end(), update);
+		auto const add_stats = [&](gray_band_stats_t<N> const& stats)
+		{
+			for (u32 bucket = 0; bucket < N; ++bucket)
+			{
+				total.hist[bucket] += stats.hist[bucket];
+			}
 
-		scale_down(hist, view.width, view.height);
+			total.sum += stats.sum;
+		};
 
-		return hist;
+		reduce_bands<gray_band_stats_t<N>>(view.height, count_rows, add_stats);
+
+		return total;
 	}
 
 
-	stats_t calc_stats(gray::view_t const& view)
+	template <size_t N>
+	hist_t<N> calc_hist(gray::view_t const& view) // TODO: untested
 	{
-		assert(N_HIST_BUCKETS <= CHANNEL_SIZE);
+		auto hist = calc_band_stats<N>(view).hist;
 
-		hist_t hist = { 0 }; // TODO: hist_t hist = calc_hist(view);
-		r32 count = 0.0f;
+		scale_down(hist, view.width, view.height);
 
-		auto const divisor = CHANNEL_SIZE / N_HIST_BUCKETS;
+		return hist;
+	}
 
-		auto const update = [&](gray::pixel_t const& shade)
-		{
-			auto bucket = shade / divisor;
-			++hist[bucket];
-			count += shade;
-		};
 
-		std::for_each(view.begin(), view.end(), update);
+	stats_t calc_stats(gray::view_t const& view)
+	{
+		auto stats = calc_band_stats<N_HIST_BUCKETS>(view);
+
+		auto& hist = stats.hist;
+		u64 count = stats.sum;
 
 		auto num_pixels = static_cast<size_t>(view.width) * view.height;
 
-		auto mean = count / num_pixels;
+		auto mean = static_cast<r32>(static_cast<r64>(count) / num_pixels);
 		assert(mean >= 0);
 		assert(mean < CHANNEL_SIZE);
 
@@ -918,18 +2690,17 @@ namespace libimage
 	}
 
 
-	void draw_histogram(hist_t const& hist, gray::image_t& image_dst)
+	template <size_t N>
+	void draw_histogram(hist_t<N> const& hist, gray::image_t& image_dst)
 	{
 		assert(!image_dst.width);
 		assert(!image_dst.height);
 		assert(!image_dst.data);
-		assert(N_HIST_BUCKETS <= CHANNEL_SIZE);
-		assert(hist.size() == N_HIST_BUCKETS);
 
 		u32 const max_relative_qty = 200;
 		u32 const image_height = max_relative_qty + 1;
 
-		u32 const n_buckets = static_cast<u32>(N_HIST_BUCKETS);
+		u32 const n_buckets = static_cast<u32>(N);
 
 		u32 const bucket_width = 20;
 		u32 const bucket_spacing = 1;
@@ -959,7 +2730,7 @@ namespace libimage
 			{
 				u8 shade = 50;// n_buckets* (bucket + 1) - 1;
 				auto bar_view = sub_view(image_dst, bar_range);
-				std::fill(bar_view.begin(), bar_view.end(), shade);
+				for_each_row(bar_view, [&](gray::pixel_t* row, u32 width) { std::fill(row, row + width, shade); });
 			}
 
 			bar_range.x_begin += (bucket_spacing + bucket_width);
@@ -969,7 +2740,8 @@ namespace libimage
 	}
 
 
-	void draw_histogram(hist_t const& hist, gray::view_t& view_dst) // TODO: untested
+	template <size_t N>
+	void draw_histogram(hist_t<N> const& hist, gray::view_t& view_dst) // TODO: untested
 	{
 		assert(view_dst.width);
 		assert(view_dst.height);
@@ -980,10 +2752,12 @@ namespace libimage
 
 		u32 const max_relative_qty = v_height - 1;
 
-		u32 const n_buckets = static_cast<u32>(N_HIST_BUCKETS);
+		u32 const n_buckets = static_cast<u32>(N);
 
 		u32 const bucket_spacing = 1;
 
+		assert(v_width > n_buckets * (bucket_spacing + 1));
+
 		u32 const bucket_width = (v_width - bucket_spacing) / n_buckets - bucket_spacing;
 
 		auto max = std::accumulate(hist.begin(), hist.end(), 0.0f);
@@ -1007,7 +2781,7 @@ namespace libimage
 			{
 				u8 shade = 50;
 				auto bar_view = sub_view(view_dst, bar_range);
-				std::fill(bar_view.begin(), bar_view.end(), shade);
+				for_each_row(bar_view, [&](gray::pixel_t* row, u32 width) { std::fill(row, row + width, shade); });
 			}
 
 			bar_range.x_begin += (bucket_spacing + bucket_width);
@@ -1016,6 +2790,62 @@ namespace libimage
 	}
 #endif // !LIBIMAGE_NO_GRAYSCALE
 
+
+	// instantiate histograms for every supported number of buckets
+
+#define LIBIMAGE_HIST_POW2_16(X) X(2) X(4) X(8) X(16)
+#define LIBIMAGE_HIST_POW2_256(X) LIBIMAGE_HIST_POW2_16(X) X(32) X(64) X(128) X(256)
+#define LIBIMAGE_HIST_POW2_4096(X) LIBIMAGE_HIST_POW2_256(X) X(512) X(1024) X(2048) X(4096)
+
+#define LIBIMAGE_HIST_COMPARE(N) \
+	template u64 hist_distance<N>(hist_t<N> const&, hist_t<N> const&); \
+	template u64 hist_intersection<N>(hist_t<N> const&, hist_t<N> const&);
+
+	LIBIMAGE_HIST_POW2_4096(LIBIMAGE_HIST_COMPARE)
+
+#undef LIBIMAGE_HIST_COMPARE
+
+#ifndef LIBIMAGE_NO_COLOR
+
+#define LIBIMAGE_HIST_COLOR(N) \
+	template hist_t<N> calc_hist<N>(view_t const&); \
+	template void draw_histogram<N>(hist_t<N> const&, view_t&, pixel_t const&); \
+	template void make_integral_hist<N>(integral_hist_t<N>&, view_t const&, u32, arena_t&); \
+	template hist_t<N> calc_hist<N>(integral_hist_t<N> const&, pixel_range_t const&);
+
+	LIBIMAGE_HIST_POW2_4096(LIBIMAGE_HIST_COLOR)
+
+#undef LIBIMAGE_HIST_COLOR
+
+	template color_hist_t<1> calc_color_hist<1>(view_t const&);
+	template color_hist_t<2> calc_color_hist<2>(view_t const&);
+	template color_hist_t<3> calc_color_hist<3>(view_t const&);
+	template color_hist_t<4> calc_color_hist<4>(view_t const&);
+
+	template void make_color_integral_hist<1>(color_integral_hist_t<1>&, view_t const&, u32, arena_t&);
+	template void make_color_integral_hist<2>(color_integral_hist_t<2>&, view_t const&, u32, arena_t&);
+	template void make_color_integral_hist<3>(color_integral_hist_t<3>&, view_t const&, u32, arena_t&);
+	template void make_color_integral_hist<4>(color_integral_hist_t<4>&, view_t const&, u32, arena_t&);
+
+#endif // !LIBIMAGE_NO_COLOR
+
+#ifndef LIBIMAGE_NO_GRAYSCALE
+
+#define LIBIMAGE_HIST_GRAY(N) \
+	template hist_t<N> calc_hist<N>(gray::view_t const&); \
+	template void draw_histogram<N>(hist_t<N> const&, gray::image_t&); \
+	template void draw_histogram<N>(hist_t<N> const&, gray::view_t&);
+
+	LIBIMAGE_HIST_POW2_256(LIBIMAGE_HIST_GRAY)
+
+#undef LIBIMAGE_HIST_GRAY
+
+#endif // !LIBIMAGE_NO_GRAYSCALE
+
+#undef LIBIMAGE_HIST_POW2_4096
+#undef LIBIMAGE_HIST_POW2_256
+#undef LIBIMAGE_HIST_POW2_16
+
 #endif // !LIBIMAGE_NO_MATH
 
 }
@@ -11,6 +11,8 @@ Copyright (c) 2021 Adam Lafontaine
 //#define LIBIMAGE_NO_RESIZE
 //#define LIBIMAGE_NO_FS
 //#define LIBIMAGE_NO_MATH
+//#define LIBIMAGE_NO_PARALLEL
+//#define LIBIMAGE_NO_SIMD
 
 #include <cstdint>
 #include <iterator>
@@ -25,10 +27,13 @@ namespace fs = std::filesystem;
 #include <array>
 #endif // !LIBIMAGE_NO_MATH
 
+#include <functional>
+
 using u8 = uint8_t;
 using u32 = uint32_t;
 using u64 = uint64_t;
 using r32 = float;
+using r64 = double;
 
 namespace libimage
 {
@@ -37,7 +42,7 @@ namespace libimage
 
 #ifndef LIBIMAGE_NO_MATH
 
-	constexpr size_t N_HIST_BUCKETS = 16; // use each shade for histograms
+	constexpr size_t N_HIST_BUCKETS = 16; // default number of histogram buckets
 
 #endif // !LIBIMAGE_NO_MATH
 	
@@ -54,6 +59,48 @@ namespace libimage
 
 	} pixel_range_t;
 
+
+	//======= image_memory.hpp ===========
+
+	// image memory is kept by size and reused when it is freed
+
+	void* alloc_image_memory(size_t n_bytes);
+
+	void* realloc_image_memory(void* data, size_t n_bytes);
+
+	void free_image_memory(void* data);
+
+	// returns kept memory to the system
+	// memory kept by other threads is returned to the pool when they end
+	void release_image_memory();
+
+
+	//======= memory_arena.hpp ===========
+
+	// linear allocator over memory owned by the caller
+	// everything pushed is released at once by reset_arena
+	typedef struct
+	{
+		u8* memory;
+		size_t capacity;
+		size_t size;
+
+	} arena_t;
+
+
+	arena_t make_arena(void* memory, size_t capacity);
+
+	// 0 if there is not enough room
+	void* push_bytes(arena_t& arena, size_t n_bytes);
+
+	// capacity is 0 if there is not enough room
+	arena_t push_arena(arena_t& parent, size_t capacity);
+
+	template <typename T>
+	inline T* push_array(arena_t& arena, size_t count) { return (T*)push_bytes(arena, sizeof(T) * count); }
+
+	inline void reset_arena(arena_t& arena) { arena.size = 0; }
+
 #ifndef LIBIMAGE_NO_COLOR
 
 	// color pixel
@@ -76,8 +123,36 @@ namespace libimage
 	using pixel_t = rgba_pixel;
 
 
+	// order of the channels of a pixel in memory
+	// BGRA is also the 32 bit value red << 16 | green << 8 | blue (XRGB)
+	enum class PixelFormat : u32
+	{
+		RGBA,
+		BGRA,
+	};
+
+
+	// the rgba pixel p written in format F
+	template <PixelFormat F>
+	inline pixel_t to_format(pixel_t const& p)
+	{
+		if constexpr (F == PixelFormat::BGRA)
+		{
+			pixel_t fp = p;
+			fp.red = p.blue;
+			fp.blue = p.red;
+
+			return fp;
+		}
+		else
+		{
+			return p;
+		}
+	}
+
+
 	// color image
-	// owns the memory
+	// owns the memory, can be moved but not copied
 	class rgba_image_t
 	{
 	public:
@@ -90,10 +165,43 @@ namespace libimage
 		{
 			if (data)
 			{
-				free(data);
+				free_image_memory(data);
+				data = 0;
 			}
 		}
 
+		rgba_image_t() = default;
+
+		rgba_image_t(rgba_image_t const&) = delete;
+
+		rgba_image_t& operator = (rgba_image_t const&) = delete;
+
+		rgba_image_t(rgba_image_t&& other) noexcept
+			: width(other.width), height(other.height), data(other.data)
+		{
+			other.width = 0;
+			other.height = 0;
+			other.data = 0;
+		}
+
+		rgba_image_t& operator = (rgba_image_t&& other) noexcept
+		{
+			if (this != &other)
+			{
+				clear();
+
+				width = other.width;
+				height = other.height;
+				data = other.data;
+
+				other.width = 0;
+				other.height = 0;
+				other.data = 0;
+			}
+
+			return *this;
+		}
+
 		~rgba_image_t()
 		{
 			clear();
@@ -190,9 +298,50 @@ namespace libimage
 				assert(loc_y <= y_end);
 			}
 
+			void prev()
+			{
+				if (loc_x == x_begin)
+				{
+					loc_x = x_end;
+					--loc_y;
+				}
+
+				--loc_x;
+
+				assert(loc_x >= x_begin);
+				assert(loc_x < x_end);
+				assert(loc_y >= y_begin);
+				assert(loc_y < y_end);
+			}
+
+			// linear position in the view, row by row
+			std::ptrdiff_t index() const
+			{
+				auto width = static_cast<std::ptrdiff_t>(x_end - x_begin);
+
+				return (static_cast<std::ptrdiff_t>(loc_y) - y_begin) * width + (loc_x - x_begin);
+			}
+
+			void set_index(std::ptrdiff_t index)
+			{
+				auto width = static_cast<std::ptrdiff_t>(x_end - x_begin);
+
+				// an empty view has only its end
+				if (width == 0)
+				{
+					end();
+					return;
+				}
+
+				loc_x = x_begin + static_cast<u32>(index % width);
+				loc_y = y_begin + static_cast<u32>(index / width);
+
+				assert(loc_y <= y_end);
+			}
+
 		public:
 
-			using iterator_category = std::forward_iterator_tag;
+			using iterator_category = std::random_access_iterator_tag;
 			using value_type = pixel_t;
 			using difference_type = std::ptrdiff_t;
 			using pointer = value_type*;
@@ -211,15 +360,13 @@ namespace libimage
 				y_end = view.y_end;
 
 				loc_x = x_begin;
-				loc_y = y_begin;
+				loc_y = x_begin == x_end ? y_end : y_begin;
 			}
 
 			iterator end()
 			{
-				loc_x = x_end - 1;
-				loc_y = y_end - 1;
-
-				next();
+				loc_x = x_begin;
+				loc_y = y_end;
 
 				return *this;
 			}
@@ -233,11 +380,44 @@ namespace libimage
 
 			iterator operator ++ (int) { iterator result = *this; ++(*this); return result; }
 
+			iterator& operator -- ()
+			{
+				prev();
+
+				return *this;
+			}
+
+			iterator operator -- (int) { iterator result = *this; --(*this); return result; }
+
+			iterator& operator += (difference_type n) { set_index(index() + n); return *this; }
+
+			iterator& operator -= (difference_type n) { set_index(index() - n); return *this; }
+
+			iterator operator + (difference_type n) const { iterator result = *this; result += n; return result; }
+
+			iterator operator - (difference_type n) const { iterator result = *this; result -= n; return result; }
+
+			friend iterator operator + (difference_type n, iterator it) { return it + n; }
+
+			difference_type operator - (iterator other) const { return index() - other.index(); }
+
 			bool operator == (iterator other) const { return loc_x == other.loc_x && loc_y == other.loc_y; }
 
 			bool operator != (iterator other) const { return !(*this == other); }
 
+			bool operator < (iterator other) const { return index() < other.index(); }
+
+			bool operator > (iterator other) const { return other < *this; }
+
+			bool operator <= (iterator other) const { return !(other < *this); }
+
+			bool operator >= (iterator other) const { return !(*this < other); }
+
 			reference operator * () const { return *loc_ptr(); }
+
+			pointer operator -> () const { return loc_ptr(); }
+
+			reference operator [] (difference_type n) const { return *(*this + n); }
 		};
 		/* ^^^^^^^^^ ITERATOR ^^^^^^^^^^ */
 
@@ -255,6 +435,40 @@ namespace libimage
 	using view_t = rgba_image_view_t;
 
 
+	// contiguous pixels of one row of a view
+	typedef struct rgba_row_span_t
+	{
+		pixel_t* data = 0;
+		u32 width = 0;
+
+		pixel_t* begin() const { return data; }
+		pixel_t* end() const { return data + width; }
+
+	} row_span_t;
+
+
+	inline row_span_t row_span(view_t const& view, u32 y)
+	{
+		row_span_t span;
+		span.data = view.row_begin(y);
+		span.width = view.width;
+
+		return span;
+	}
+
+
+	// func(pixel_t* row, u32 width) is called once per row
+	// loops over a row are contiguous and can be vectorized
+	template <class ROW_F>
+	inline void for_each_row(view_t const& view, ROW_F const& func)
+	{
+		for (u32 y = 0; y < view.height; ++y)
+		{
+			func(view.row_begin(y), view.width);
+		}
+	}
+
+
 	constexpr pixel_t to_pixel(u8 red, u8 green, u8 blue, u8 alpha)
 	{
 		pixel_t pixel{};
@@ -288,6 +502,7 @@ namespace libimage
 
 
 		// grayscale image
+		// owns the memory, can be moved but not copied
 		class image_t
 		{
 		public:
@@ -300,10 +515,43 @@ namespace libimage
 			{
 				if (data)
 				{
-					free(data);
+					free_image_memory(data);
+					data = 0;
 				}
 			}
 
+			image_t() = default;
+
+			image_t(image_t const&) = delete;
+
+			image_t& operator = (image_t const&) = delete;
+
+			image_t(image_t&& other) noexcept
+				: width(other.width), height(other.height), data(other.data)
+			{
+				other.width = 0;
+				other.height = 0;
+				other.data = 0;
+			}
+
+			image_t& operator = (image_t&& other) noexcept
+			{
+				if (this != &other)
+				{
+					clear();
+
+					width = other.width;
+					height = other.height;
+					data = other.data;
+
+					other.width = 0;
+					other.height = 0;
+					other.data = 0;
+				}
+
+				return *this;
+			}
+
 			~image_t()
 			{
 				clear();
@@ -392,9 +640,50 @@ namespace libimage
 					assert(loc_y <= y_end);
 				}
 
+				void prev()
+				{
+					if (loc_x == x_begin)
+					{
+						loc_x = x_end;
+						--loc_y;
+					}
+
+					--loc_x;
+
+					assert(loc_x >= x_begin);
+					assert(loc_x < x_end);
+					assert(loc_y >= y_begin);
+					assert(loc_y < y_end);
+				}
+
+				// linear position in the view, row by row
+				std::ptrdiff_t index() const
+				{
+					auto width = static_cast<std::ptrdiff_t>(x_end - x_begin);
+
+					return (static_cast<std::ptrdiff_t>(loc_y) - y_begin) * width + (loc_x - x_begin);
+				}
+
+				void set_index(std::ptrdiff_t index)
+				{
+					auto width = static_cast<std::ptrdiff_t>(x_end - x_begin);
+
+					// an empty view has only its end
+					if (width == 0)
+					{
+						end();
+						return;
+					}
+
+					loc_x = x_begin + static_cast<u32>(index % width);
+					loc_y = y_begin + static_cast<u32>(index / width);
+
+					assert(loc_y <= y_end);
+				}
+
 			public:
 
-				using iterator_category = std::forward_iterator_tag;
+				using iterator_category = std::random_access_iterator_tag;
 				using value_type = pixel_t;
 				using difference_type = std::ptrdiff_t;
 				using pointer = value_type*;
@@ -413,14 +702,13 @@ namespace libimage
 					y_end = view.y_end;
 
 					loc_x = x_begin;
-					loc_y = y_begin;
+					loc_y = x_begin == x_end ? y_end : y_begin;
 				}
 
 				iterator end()
 				{
-					loc_x = x_end - 1;
-					loc_y = y_end - 1;
-					next();
+					loc_x = x_begin;
+					loc_y = y_end;
 
 					return *this;
 				}
@@ -434,11 +722,44 @@ namespace libimage
 
 				iterator operator ++ (int) { iterator result = *this; ++(*this); return result; }
 
+				iterator& operator -- ()
+				{
+					prev();
+
+					return *this;
+				}
+
+				iterator operator -- (int) { iterator result = *this; --(*this); return result; }
+
+				iterator& operator += (difference_type n) { set_index(index() + n); return *this; }
+
+				iterator& operator -= (difference_type n) { set_index(index() - n); return *this; }
+
+				iterator operator + (difference_type n) const { iterator result = *this; result += n; return result; }
+
+				iterator operator - (difference_type n) const { iterator result = *this; result -= n; return result; }
+
+				friend iterator operator + (difference_type n, iterator it) { return it + n; }
+
+				difference_type operator - (iterator other) const { return index() - other.index(); }
+
 				bool operator == (iterator other) const { return loc_x == other.loc_x && loc_y == other.loc_y; }
 
 				bool operator != (iterator other) const { return !(*this == other); }
 
+				bool operator < (iterator other) const { return index() < other.index(); }
+
+				bool operator > (iterator other) const { return other < *this; }
+
+				bool operator <= (iterator other) const { return !(other < *this); }
+
+				bool operator >= (iterator other) const { return !(*this < other); }
+
 				reference operator * () const { return *loc_ptr(); }
+
+				pointer operator -> () const { return loc_ptr(); }
+
+				reference operator [] (difference_type n) const { return *(*this + n); }
 			};
 			/* ^^^^^^^^^ ITERATOR ^^^^^^^^^^ */
 
@@ -454,12 +775,92 @@ namespace libimage
 		using view_t = image_view_t;
 
 
+		// contiguous pixels of one row of a view
+		typedef struct row_span_t
+		{
+			pixel_t* data = 0;
+			u32 width = 0;
+
+			pixel_t* begin() const { return data; }
+			pixel_t* end() const { return data + width; }
+
+		} row_span_t;
+
+
+		inline row_span_t row_span(view_t const& view, u32 y)
+		{
+			row_span_t span;
+			span.data = view.row_begin(y);
+			span.width = view.width;
+
+			return span;
+		}
+
+
+		// func(pixel_t* row, u32 width) is called once per row
+		template <class ROW_F>
+		inline void for_each_row(view_t const& view, ROW_F const& func)
+		{
+			for (u32 y = 0; y < view.height; ++y)
+			{
+				func(view.row_begin(y), view.width);
+			}
+		}
+
+
 	}
 
 	namespace grey = gray;
 
 #endif // !LIBIMAGE_NO_GRAYSCALE
 
+	//======= libimage_parallel.hpp =========
+
+	// work stealing thread pool shared by all libimage functions
+	// workers are started on first use
+	// with LIBIMAGE_NO_PARALLEL there are no workers and everything runs on the calling thread
+
+	using task_f = std::function<void()>;
+
+	// refers to func(u32 begin, u32 end) without copying it
+	// only valid during the call it is passed to
+	class range_ref_t
+	{
+	public:
+		void const* func = 0;
+		void (*invoke)(void const* func, u32 begin, u32 end) = 0;
+
+		template <class F>
+		range_ref_t(F const& f)
+			: func(&f), invoke([](void const* p, u32 begin, u32 end) { (*static_cast<F const*>(p))(begin, end); })
+		{}
+
+		void operator () (u32 begin, u32 end) const { invoke(func, begin, end); }
+	};
+
+	using range_f = range_ref_t;
+
+	// 0 = one worker per core
+	// running workers finish the queued tasks and are restarted with the new limit
+	void set_max_workers(u32 max_workers);
+
+	u32 worker_count();
+
+	// queue a task to be run by a worker thread
+	// the calling thread runs it if the queue is full
+	// a task capturing more than a pointer or two is copied to the heap by std::function
+	void run_async(task_f const& task);
+
+	// splits [begin, end) into chunks of grain_size and runs them on the workers
+	// the calling thread helps and returns when all chunks are done
+	// grain_size = 0 picks a size from the number of workers
+	void parallel_for(u32 begin, u32 end, range_f const& func, u32 grain_size = 0);
+
+	// runs the queued tasks and joins the workers
+	// must be called before exit, the workers are not joined by a static destructor
+	void stop_workers();
+
+
 	//======= libimage.hpp ==================
 #ifndef LIBIMAGE_NO_COLOR
 
@@ -469,6 +870,9 @@ namespace libimage
 
 	view_t make_view(image_t const& image);
 
+	// pixels are pushed to the arena, returns an empty view if it is full
+	view_t push_view(arena_t& arena, u32 width, u32 height);
+
 	view_t sub_view(image_t const& image, pixel_range_t const& range);
 
 	view_t sub_view(view_t const& view, pixel_range_t const& range);
@@ -495,6 +899,9 @@ namespace libimage
 
 	void write_view(view_t const& view_src, const char* file_path_dst);
 
+	// copies the view to the arena instead of allocating
+	void write_view(view_t const& view_src, const char* file_path_dst, arena_t& scratch);
+
 #endif // !LIBIMAGE_NO_WRITE
 
 
@@ -502,6 +909,14 @@ namespace libimage
 
 	void resize_image(image_t const& image_src, image_t& image_dst);
 
+	// resizes into the existing image_dst.data, written in format F
+	template <PixelFormat F>
+	void resize_to_format(image_t const& image_src, image_t& image_dst);
+
+	// view_dst rows can be anywhere in a larger image
+	template <PixelFormat F>
+	void resize_to_format(image_t const& image_src, view_t const& view_dst);
+
 	view_t make_resized_view(image_t const& image_src, image_t& image_dst);
 
 #endif // !LIBIMAGE_NO_RESIZE
@@ -543,6 +958,8 @@ namespace libimage
 
 	void write_view(gray::view_t const& view_src, const char* file_path_dst);
 
+	void write_view(gray::view_t const& view_src, const char* file_path_dst, arena_t& scratch);
+
 #endif // !LIBIMAGE_NO_WRITE
 
 #ifndef LIBIMAGE_NO_RESIZE
@@ -615,16 +1032,57 @@ namespace libimage
 	//======= libimage_math.hpp =========================
 #ifndef LIBIMAGE_NO_MATH
 
-	using hist_t = std::array<u32, N_HIST_BUCKETS>; // TODO: size_t?
+	// N must be a power of 2
+	// N <= 4096 for color histograms, N <= CHANNEL_SIZE for grayscale
+	template <size_t N = N_HIST_BUCKETS>
+	using hist_t = std::array<u32, N>; // TODO: size_t?
 
-	inline hist_t empty_hist() { hist_t h = { 0 }; return h; }
+	template <size_t N = N_HIST_BUCKETS>
+	inline hist_t<N> empty_hist() { hist_t<N> h = { 0 }; return h; }
+
+
+	// histogram counts summed over a grid of square cells
+	// the histogram of any range of cells is found from the counts at its four corners
+	template <size_t N = N_HIST_BUCKETS>
+	struct integral_hist_t
+	{
+		u32 width = 0;
+		u32 height = 0;
+		u32 cell_size = 0;
+		u32 cells_x = 0;
+		u32 cells_y = 0;
+
+		// (cells_x + 1) * (cells_y + 1) corners of N buckets
+		// each corner counts the pixels above and to the left of it
+		u32* counts = 0;
+	};
+
+
+	// arena memory used by an integral histogram
+	template <size_t N>
+	inline size_t integral_hist_bytes(u32 width, u32 height, u32 cell_size)
+	{
+		size_t cells_x = (width + cell_size - 1) / cell_size;
+		size_t cells_y = (height + cell_size - 1) / cell_size;
+
+		return (cells_x + 1) * (cells_y + 1) * N * sizeof(u32);
+	}
+
+
+	// sum of the differences of each bucket
+	template <size_t N>
+	u64 hist_distance(hist_t<N> const& lhs, hist_t<N> const& rhs);
+
+	// sum of the smaller count of each bucket, larger is more similar
+	template <size_t N>
+	u64 hist_intersection(hist_t<N> const& lhs, hist_t<N> const& rhs);
 
 
 	typedef struct channel_stats_t
 	{
 		r32 mean;
 		r32 std_dev;
-		hist_t hist;
+		hist_t<> hist;
 
 	} stats_t;
 
@@ -645,25 +1103,57 @@ namespace libimage
 
 #ifndef LIBIMAGE_NO_COLOR
 
-	hist_t calc_hist(view_t const& view); // TODO: untested
+	template <size_t N = N_HIST_BUCKETS>
+	hist_t<N> calc_hist(view_t const& view);
 
 	rgb_stats_t calc_stats(view_t const& view);
 
 	void draw_histogram(rgb_stats_t const& rgb_stats, image_t& image_dst);
 
-	void draw_histogram(hist_t const& hist, view_t& view_dst, pixel_t const& color); // TODO: untested
+	template <size_t N>
+	void draw_histogram(hist_t<N> const& hist, view_t& view_dst, pixel_t const& color); // TODO: untested
+
+
+	// joint histogram of the high BITS of each channel, 1 <= BITS <= 4
+	// bucket = red << 2 * BITS | green << BITS | blue
+	template <u32 BITS>
+	constexpr size_t color_hist_buckets() { return size_t(1) << (3 * BITS); }
+
+	template <u32 BITS = 3>
+	using color_hist_t = hist_t<color_hist_buckets<BITS>()>;
+
+	template <u32 BITS = 3>
+	color_hist_t<BITS> calc_color_hist(view_t const& view);
+
+	template <u32 BITS = 3>
+	using color_integral_hist_t = integral_hist_t<color_hist_buckets<BITS>()>;
+
+	// cell_size = 1 gives exact histograms for any range
+	// counts are pushed to the arena
+	template <size_t N>
+	void make_integral_hist(integral_hist_t<N>& dst, view_t const& view, u32 cell_size, arena_t& arena);
+
+	template <u32 BITS>
+	void make_color_integral_hist(color_integral_hist_t<BITS>& dst, view_t const& view, u32 cell_size, arena_t& arena);
+
+	// range is rounded to the nearest cells, same scale as calc_hist
+	template <size_t N>
+	hist_t<N> calc_hist(integral_hist_t<N> const& integral, pixel_range_t const& range);
 
 #endif // !LIBIMAGE_NO_COLOR
 
 #ifndef	LIBIMAGE_NO_GRAYSCALE
 
-	hist_t calc_hist(gray::view_t const& view); // TODO: untested
+	template <size_t N = N_HIST_BUCKETS>
+	hist_t<N> calc_hist(gray::view_t const& view); // TODO: untested
 
 	stats_t calc_stats(gray::view_t const& view);
 
-	void draw_histogram(hist_t const& hist, gray::image_t& image_dst);
+	template <size_t N>
+	void draw_histogram(hist_t<N> const& hist, gray::image_t& image_dst);
 
-	void draw_histogram(hist_t const& hist, gray::view_t& view_dst); // TODO: untested
+	template <size_t N>
+	void draw_histogram(hist_t<N> const& hist, gray::view_t& view_dst); // TODO: untested
 
 #endif // !LIBIMAGE_NO_GRAYSCALE
 
@@ -16,6 +16,14 @@ Copyright (c) 2021 Adam Lafontaine
 #define STBI_NO_TGA
 
 
+// decoded images are freed with the image memory of libimage
+// can be defined before this file to hook them, they must still use image memory
+#ifndef STBI_MALLOC
+#define STBI_MALLOC(sz) libimage::alloc_image_memory(sz)
+#define STBI_REALLOC(p, newsz) libimage::realloc_image_memory(p, newsz)
+#define STBI_FREE(p) libimage::free_image_memory(p)
+#endif // !STBI_MALLOC
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -27,6 +35,10 @@ Copyright (c) 2021 Adam Lafontaine
 
 
 #ifndef LIBIMAGE_NO_RESIZE
+// scratch memory is reused for each resize
+#define STBIR_MALLOC(size, c) ((void)(c), libimage::alloc_image_memory(size))
+#define STBIR_FREE(ptr, c) ((void)(c), libimage::free_image_memory(ptr))
+
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
 #include "stb_image_resize.h"
 #endif // !LIBIMAGE_NO_RESIZE
@@ -22,11 +22,14 @@ GlobalVariable win32::BitmapBuffer g_back_buffer = {};
 GlobalVariable i64 g_perf_count_frequency;
 GlobalVariable WINDOWPLACEMENT g_window_placement = { sizeof(g_window_placement) };
 
+// memory given to the application
+GlobalVariable app::AppMemory g_app_memory = {};
+
 
 void end_program()
 {
     g_running = false;
-    app::end_program();
+    app::end_program(g_app_memory);
 }
 
 
@@ -198,7 +201,7 @@ static app::AppMemory allocate_app_memory(win32::MemoryState& win32_memory)
     app::AppMemory memory = {};
 
     memory.permanent_storage_size = Megabytes(256);
-    memory.transient_storage_size = 0; // Gigabytes(1);
+    memory.transient_storage_size = Megabytes(64);
 
     size_t total_size = memory.permanent_storage_size + memory.transient_storage_size;
 
@@ -223,8 +226,6 @@ static app::PixelBuffer make_app_pixel_buffer()
     buffer.height = g_back_buffer.height;
     buffer.bytes_per_pixel = g_back_buffer.bytes_per_pixel;
 
-    buffer.to_color32 = [](u8 red, u8 green, u8 blue) { return red << 16 | green << 8 | blue; };
-
     return buffer;
 }
 
@@ -323,8 +324,8 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     auto window_dims = win32::get_window_dimensions(window);
 
     win32::MemoryState win32_memory = {};
-    auto app_memory = allocate_app_memory(win32_memory);
-    if (!app_memory.permanent_storage || !app_memory.transient_storage)
+    g_app_memory = allocate_app_memory(win32_memory);
+    if (!g_app_memory.permanent_storage || !g_app_memory.transient_storage)
     {
         return 0;
     }    
@@ -376,7 +377,7 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     {
         win32::process_keyboard_input(old_input->keyboard, new_input->keyboard);        
         win32::record_mouse_input(window, old_input->mouse, new_input->mouse);
-        app::update_and_render(app_memory, *new_input, app_pixel_buffer);
+        app::update_and_render(g_app_memory, *new_input, app_pixel_buffer);
 
         wait_for_framerate();
 